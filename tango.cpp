@@ -1,18 +1,58 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cassert>
+#include <array>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Software prefetch hint for the next level of a pointer chase.
+// Build with -DTANGO_NO_PREFETCH to compile the hints out.
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(TANGO_NO_PREFETCH)
+#define TANGO_PREFETCH(p) __builtin_prefetch((p), 0, 3)
+#else
+#define TANGO_PREFETCH(p) ((void)(p))
+#endif
+
+struct LeafBlock;
 
 //Reference tree node
+// The fields a search step reads (key, left, right, block) come first so a
+// step usually stays within one cache line.
 struct RefNode {
     int key;
-    RefNode *left, *right, *parent;
+
+    // number of nodes in this subtree (order statistics)
+    int size;
+
+    RefNode *left, *right;
+
+    // packed copy of this subtree's keys, set only on leaf-block roots
+    LeafBlock *block;
+
+    RefNode *parent;
     void *aux_ptr;
 
     // preferred child
     RefNode *preferred;
 
-    RefNode(int k) : key(k), left(nullptr), right(nullptr), parent(nullptr),
-                     aux_ptr(nullptr), preferred(nullptr) {}
+    // 'preferred' as of the start of background rebuild 'pref_epoch', saved
+    // when it changes during that rebuild (see rebuild_pref)
+    RefNode *saved_pref;
+    uint32_t pref_epoch;
+
+    RefNode(int k) : key(k), size(1), left(nullptr), right(nullptr), block(nullptr),
+                     parent(nullptr), aux_ptr(nullptr), preferred(nullptr),
+                     saved_pref(nullptr), pref_epoch(0) {}
 };
 
 //Auxiliary (splay) tree node
@@ -208,6 +248,10 @@ void free_aux_tree(AuxNode *a) {
 }
 
 //Reference tree helpers
+int ref_size(RefNode *r) {
+    return r ? r->size : 0;
+}
+
 RefNode* build_ref_from_sorted(int *arr, int l, int r) {
     if (l > r) return nullptr;
     int mid = (l + r) / 2;
@@ -216,11 +260,109 @@ RefNode* build_ref_from_sorted(int *arr, int l, int r) {
     if (node->left) node->left->parent = node;
     node->right = build_ref_from_sorted(arr, mid+1, r);
     if (node->right) node->right->parent = node;
+    node->size = 1 + ref_size(node->left) + ref_size(node->right);
     node->preferred = nullptr;
     node->aux_ptr = nullptr;
     return node;
 }
 
+// --- Access-weighted reference tree construction ---
+// Knuth's O(n^2) DP gives the optimal static BST for per-key weights; it needs
+// O(n^2) tables, so above this size Mehlhorn's bisection rule is used instead.
+const int KNUTH_MAX_N = 512;
+
+RefNode* ref_from_root_table(int *keys, int *root, int m, int i, int j) {
+    // half-open key range [i, j)
+    if (i >= j) return nullptr;
+    int r = root[i*m + j];
+    RefNode *node = new RefNode(keys[r]);
+    node->left = ref_from_root_table(keys, root, m, i, r);
+    if (node->left) node->left->parent = node;
+    node->right = ref_from_root_table(keys, root, m, r+1, j);
+    if (node->right) node->right->parent = node;
+    node->size = 1 + ref_size(node->left) + ref_size(node->right);
+    return node;
+}
+
+// 'w' must be non-negative
+RefNode* build_ref_optimal(int *keys, double *w, int n) {
+    if (n <= 0) return nullptr;
+    int m = n + 1;
+    double *S = (double*)malloc(sizeof(double) * m);
+    S[0] = 0;
+    for (int i = 0; i < n; ++i) S[i+1] = S[i] + w[i];
+    double *e = (double*)malloc(sizeof(double) * m * m);
+    int *root = (int*)malloc(sizeof(int) * m * m);
+    for (int i = 0; i <= n; ++i) { e[i*m + i] = 0; root[i*m + i] = i; }
+    for (int len = 1; len <= n; ++len) {
+        for (int i = 0; i + len <= n; ++i) {
+            int j = i + len;
+            // Knuth: root[i][j-1] <= root[i][j] <= root[i+1][j]
+            int lo = len == 1 ? i : root[i*m + j-1];
+            int hi = len == 1 ? i : root[(i+1)*m + j];
+            double best = 0;
+            int best_r = lo;
+            for (int r = lo; r <= hi; ++r) {
+                double c = e[i*m + r] + e[(r+1)*m + j];
+                if (r == lo || c < best) { best = c; best_r = r; }
+            }
+            e[i*m + j] = best + S[j] - S[i];
+            root[i*m + j] = best_r;
+        }
+    }
+    RefNode *res = ref_from_root_table(keys, root, m, 0, n);
+    free(root);
+    free(e);
+    free(S);
+    return res;
+}
+
+// Mehlhorn: root each range at the key holding its weight midpoint. S is the
+// prefix-sum array (S[i+1] - S[i] == w[i]).
+RefNode* build_ref_weight_balanced(int *keys, double *S, int l, int r) {
+    if (l > r) return nullptr;
+    int k;
+    if (S[r+1] - S[l] <= 0) {
+        k = (l + r) / 2;
+    } else {
+        double target = (S[l] + S[r+1]) / 2;
+        int lo = l, hi = r;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (S[mid+1] >= target) hi = mid;
+            else lo = mid + 1;
+        }
+        k = lo;
+    }
+    RefNode *node = new RefNode(keys[k]);
+    node->left = build_ref_weight_balanced(keys, S, l, k-1);
+    if (node->left) node->left->parent = node;
+    node->right = build_ref_weight_balanced(keys, S, k+1, r);
+    if (node->right) node->right->parent = node;
+    node->size = 1 + ref_size(node->left) + ref_size(node->right);
+    return node;
+}
+
+// Near-optimal static reference tree for sorted 'keys' with access weights
+// 'w'; negative weights count as 0.
+RefNode* build_ref_from_weights(int *keys, double *w, int n) {
+    if (n <= 0) return nullptr;
+    double *cw = (double*)malloc(sizeof(double) * n);
+    for (int i = 0; i < n; ++i) cw[i] = w[i] > 0 ? w[i] : 0;
+    RefNode *res;
+    if (n <= KNUTH_MAX_N) {
+        res = build_ref_optimal(keys, cw, n);
+    } else {
+        double *S = (double*)malloc(sizeof(double) * (n + 1));
+        S[0] = 0;
+        for (int i = 0; i < n; ++i) S[i+1] = S[i] + cw[i];
+        res = build_ref_weight_balanced(keys, S, 0, n-1);
+        free(S);
+    }
+    free(cw);
+    return res;
+}
+
 RefNode* bst_search(RefNode *root, int key) {
     RefNode *cur = root;
     while (cur) {
@@ -231,6 +373,165 @@ RefNode* bst_search(RefNode *root, int key) {
     return nullptr;
 }
 
+// Batched lookups with group prefetching: PREFETCH_GROUP independent searches
+// advance one level per round, so each lane's cache miss overlaps with the
+// others. A lane that finishes picks up the next key. out[i] is nullptr on a miss.
+const int PREFETCH_GROUP = 16;
+
+void bst_search_batch(RefNode *root, const int *keys, int n, RefNode **out) {
+    RefNode *cur[PREFETCH_GROUP];
+    int idx[PREFETCH_GROUP];
+    int next = 0, active = 0;
+    for (int g = 0; g < PREFETCH_GROUP; ++g) {
+        if (next < n) { idx[g] = next++; cur[g] = root; active++; }
+        else idx[g] = -1;
+    }
+    while (active > 0) {
+        for (int g = 0; g < PREFETCH_GROUP; ++g) {
+            if (idx[g] < 0) continue;
+            RefNode *c = cur[g];
+            int key = keys[idx[g]];
+            if (!c || c->key == key) {
+                out[idx[g]] = c;
+                if (next < n) { idx[g] = next++; cur[g] = root; }
+                else { idx[g] = -1; active--; }
+                continue;
+            }
+            c = key < c->key ? c->left : c->right;
+            if (c) TANGO_PREFETCH(c);
+            cur[g] = c;
+        }
+    }
+}
+
+// --- Packed leaf blocks for the bottom levels ---
+// Every maximal subtree with at most LEAF_BLOCK_KEYS nodes is packed into a
+// two-level 16-ary block: its keys sorted in 16 cache lines of 16 (padded with
+// INT_MAX), plus one line holding the largest key of each of those lines.
+// A search follows pointers down to a block root, then needs two vector
+// compares (separator line, key line) instead of ~8 dependent node misses.
+// Blocks are a read-side index over a static tree: any structural change must
+// drop them first (leaf_blocks_free), and they can be rebuilt after.
+// Subtrees under LEAF_BLOCK_MIN_KEYS nodes (small ones left beside a big
+// sibling in an unbalanced tree) get no block: a ~3KB block would save only a
+// few node visits there, so they are searched node by node.
+const int LEAF_LINE_KEYS = 16;    // ints per 64-byte line
+const int LEAF_BLOCK_KEYS = LEAF_LINE_KEYS * LEAF_LINE_KEYS;
+const int LEAF_BLOCK_MIN_KEYS = LEAF_BLOCK_KEYS / 4;
+
+struct alignas(64) LeafBlock {
+    int seps[LEAF_LINE_KEYS];     // seps[j] = keys[16*j + 15]
+    int keys[LEAF_BLOCK_KEYS];
+    RefNode *nodes[LEAF_BLOCK_KEYS];
+    RefNode *root;
+    LeafBlock *next;
+};
+
+void leaf_block_fill(RefNode *n, LeafBlock *b, int &count) {
+    if (!n) return;
+    leaf_block_fill(n->left, b, count);
+    b->keys[count] = n->key;
+    b->nodes[count] = n;
+    count++;
+    leaf_block_fill(n->right, b, count);
+}
+
+// Build blocks under 'n', prepending them to 'list'
+void leaf_blocks_build(RefNode *n, LeafBlock *&list) {
+    if (!n) return;
+    if (n->size > LEAF_BLOCK_KEYS) {
+        leaf_blocks_build(n->left, list);
+        leaf_blocks_build(n->right, list);
+        return;
+    }
+    if (n->size < LEAF_BLOCK_MIN_KEYS) return;
+    LeafBlock *b = (LeafBlock*)aligned_alloc(alignof(LeafBlock), sizeof(LeafBlock));
+    int count = 0;
+    leaf_block_fill(n, b, count);
+    for (int i = count; i < LEAF_BLOCK_KEYS; ++i) {
+        b->keys[i] = INT_MAX;
+        b->nodes[i] = nullptr;
+    }
+    for (int j = 0; j < LEAF_LINE_KEYS; ++j) b->seps[j] = b->keys[j*LEAF_LINE_KEYS + LEAF_LINE_KEYS-1];
+    b->root = n;
+    b->next = list;
+    list = b;
+    n->block = b;
+}
+
+void leaf_blocks_free(LeafBlock *list) {
+    while (list) {
+        LeafBlock *next = list->next;
+        list->root->block = nullptr;
+        free(list);
+        list = next;
+    }
+}
+
+// Number of entries < key in one aligned line of LEAF_LINE_KEYS ints, without
+// branches: each compare lane is -1 where line[i] < key, so the lane sum is -count.
+int leaf_line_count_less(const int *line, int key) {
+#if defined(__AVX2__)
+    __m256i k = _mm256_set1_epi32(key);
+    __m256i lo = _mm256_cmpgt_epi32(k, _mm256_load_si256((const __m256i*)line));
+    __m256i hi = _mm256_cmpgt_epi32(k, _mm256_load_si256((const __m256i*)(line + 8)));
+    __m256i sum8 = _mm256_add_epi32(lo, hi);
+    __m128i sum4 = _mm_add_epi32(_mm256_castsi256_si128(sum8), _mm256_extracti128_si256(sum8, 1));
+#elif defined(__SSE2__)
+    __m128i k = _mm_set1_epi32(key);
+    __m128i sum4 = _mm_setzero_si128();
+    for (int i = 0; i < LEAF_LINE_KEYS; i += 4) {
+        sum4 = _mm_add_epi32(sum4, _mm_cmpgt_epi32(k, _mm_load_si128((const __m128i*)(line + i))));
+    }
+#endif
+#if defined(__AVX2__) || defined(__SSE2__)
+    sum4 = _mm_add_epi32(sum4, _mm_shuffle_epi32(sum4, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum4 = _mm_add_epi32(sum4, _mm_shuffle_epi32(sum4, _MM_SHUFFLE(2, 3, 0, 1)));
+    return -_mm_cvtsi128_si32(sum4);
+#else
+    int c = 0;
+    for (int i = 0; i < LEAF_LINE_KEYS; ++i) c += line[i] < key;
+    return c;
+#endif
+}
+
+// Node holding 'key' in the block, or nullptr
+RefNode* leaf_block_find(const LeafBlock *b, int key) {
+    int line = leaf_line_count_less(b->seps, key);
+    if (line >= LEAF_LINE_KEYS) return nullptr;
+    int idx = line * LEAF_LINE_KEYS + leaf_line_count_less(b->keys + line * LEAF_LINE_KEYS, key);
+    if (b->keys[idx] == key) return b->nodes[idx];
+    return nullptr;
+}
+
+// bst_search that switches to the packed block once it reaches one
+RefNode* bst_search_blocked(RefNode *root, int key) {
+    RefNode *cur = root;
+    while (cur) {
+        if (cur->block) return leaf_block_find(cur->block, key);
+        if (key == cur->key) return cur;
+        if (key < cur->key) cur = cur->left;
+        else cur = cur->right;
+    }
+    return nullptr;
+}
+
+// Expected search cost sum(w[i] * depth(keys[i])), root at depth 1
+double ref_weighted_cost(RefNode *root, int *keys, double *w, int n) {
+    double total = 0;
+    for (int i = 0; i < n; ++i) {
+        int depth = 0;
+        RefNode *cur = root;
+        while (cur) {
+            ++depth;
+            if (keys[i] == cur->key) break;
+            cur = keys[i] < cur->key ? cur->left : cur->right;
+        }
+        total += w[i] * depth;
+    }
+    return total;
+}
+
 // BST insert (no rebalancing)
 RefNode* bst_insert(RefNode *&root, int key) {
     if (!root) {
@@ -249,6 +550,7 @@ RefNode* bst_insert(RefNode *&root, int key) {
     n->parent = par;
     if (key < par->key) par->left = n;
     else par->right = n;
+    for (RefNode *p = par; p; p = p->parent) p->size++;
     return n;
 }
 
@@ -258,6 +560,8 @@ void bst_transplant(RefNode *&root, RefNode *u, RefNode *v) {
     else if (u == u->parent->left) u->parent->left = v;
     else u->parent->right = v;
     if (v) v->parent = u->parent;
+    // v takes u's place on a preferred path
+    if (u->parent && u->parent->preferred == u) u->parent->preferred = v;
 }
 
 // Find min in subtree
@@ -266,9 +570,21 @@ RefNode* bst_minimum(RefNode* x) {
     return x;
 }
 
-// BST delete node
-void bst_delete(RefNode *&root, RefNode *z) {
+RefNode* bst_maximum(RefNode* x) {
+    while (x && x->right) x = x->right;
+    return x;
+}
+
+// Unlink z from the tree without freeing it
+void bst_unlink(RefNode *&root, RefNode *z) {
     if (!z) return;
+    // one node leaves the subtree of every ancestor of the spliced-out position
+    RefNode *lowest = z->parent;
+    if (z->left && z->right) {
+        RefNode *s = bst_minimum(z->right);
+        lowest = s->parent;
+    }
+    for (RefNode *p = lowest; p; p = p->parent) p->size--;
     if (z->left == nullptr) {
         bst_transplant(root, z, z->right);
     } else if (z->right == nullptr) {
@@ -283,11 +599,141 @@ void bst_delete(RefNode *&root, RefNode *z) {
         bst_transplant(root, z, y);
         y->left = z->left;
         if (y->left) y->left->parent = y;
+        y->size = z->size;
+        // y's old preferred child may have stayed behind at y's old position
+        y->preferred = nullptr;
     }
+}
+
+// BST delete node
+void bst_delete(RefNode *&root, RefNode *z) {
+    if (!z) return;
+    bst_unlink(root, z);
     // free z
     delete z;
 }
 
+// --- Whole-tree split and join ---
+// Split 'root' into keys <= key (left) and keys > key (right) by cutting
+// along the search path, O(depth). Only path nodes change: their sizes are
+// recomputed, and a preferred child that was cut away is replaced by the node
+// now on that side (so the left tree matches ref_erase_run of keys > key).
+void ref_split(RefNode *root, int key, RefNode *&left, RefNode *&right) {
+    left = right = nullptr;
+    RefNode **lhook = &left, **rhook = &right;
+    RefNode *lpar = nullptr, *rpar = nullptr;
+    int capacity = 64, len = 0;
+    RefNode **path = (RefNode**)malloc(sizeof(RefNode*) * capacity);
+    RefNode *cur = root;
+    while (cur) {
+        if (len >= capacity) {
+            capacity *= 2;
+            path = (RefNode**)realloc(path, sizeof(RefNode*) * capacity);
+        }
+        path[len++] = cur;
+        RefNode *next;
+        if (cur->key <= key) {
+            *lhook = cur;
+            cur->parent = lpar;
+            lpar = cur;
+            lhook = &cur->right;
+            next = cur->right;
+        } else {
+            *rhook = cur;
+            cur->parent = rpar;
+            rpar = cur;
+            rhook = &cur->left;
+            next = cur->left;
+        }
+        cur = next;
+    }
+    *lhook = nullptr;
+    *rhook = nullptr;
+    for (int i = len - 1; i >= 0; --i) {
+        RefNode *n = path[i];
+        if (n->right) n->right->parent = n;
+        if (n->left) n->left->parent = n;
+        // path[i+1] was the child on the side that got relinked
+        if (i + 1 < len && n->preferred == path[i+1]) n->preferred = n->key <= key ? n->right : n->left;
+        if (n->preferred != n->left && n->preferred != n->right) n->preferred = nullptr;
+        n->size = 1 + ref_size(n->left) + ref_size(n->right);
+    }
+    free(path);
+}
+
+// Join two trees where every key in 'left' is smaller than every key in
+// 'right': the maximum of 'left' is detached and becomes the new root, O(depth).
+RefNode* ref_join(RefNode *left, RefNode *right) {
+    if (!left) return right;
+    if (!right) return left;
+    RefNode *m = bst_maximum(left);
+    for (RefNode *p = m->parent; p; p = p->parent) p->size--;
+    bst_transplant(left, m, m->left);
+    m->parent = nullptr;
+    m->left = left;
+    if (left) left->parent = m;
+    m->right = right;
+    right->parent = m;
+    m->preferred = nullptr;
+    m->size = 1 + ref_size(left) + ref_size(right);
+    return m;
+}
+
+// --- Bulk insert / erase of sorted runs ---
+// First index in keys[l, r) that is >= key
+int run_lower_bound(const int *keys, int l, int r, int key) {
+    while (l < r) {
+        int mid = (l + r) / 2;
+        if (keys[mid] < key) l = mid + 1;
+        else r = mid;
+    }
+    return l;
+}
+
+// Merge the strictly increasing run keys[l, r) into the subtree at 'slot'
+// (whose parent is 'par') in one top-down pass: each node splits the run
+// around its key, and a run that falls into an empty slot becomes a balanced
+// subtree. Existing nodes and preferred pointers are untouched apart from
+// sizes. Returns the number of nodes added.
+int ref_insert_run(RefNode *&slot, RefNode *par, int *keys, int l, int r) {
+    if (l >= r) return 0;
+    RefNode *n = slot;
+    if (!n) {
+        slot = build_ref_from_sorted(keys, l, r-1);
+        slot->parent = par;
+        return r - l;
+    }
+    int mid = run_lower_bound(keys, l, r, n->key);
+    int hi = mid < r && keys[mid] == n->key ? mid + 1 : mid;
+    int added = ref_insert_run(n->left, n, keys, l, mid) + ref_insert_run(n->right, n, keys, hi, r);
+    n->size += added;
+    return added;
+}
+
+// Remove every key of the sorted run keys[l, r) from the subtree at 'slot'.
+// A removed node is replaced by the join of its (already pruned) children.
+// Returns the number of nodes removed.
+int ref_erase_run(RefNode *&slot, const int *keys, int l, int r) {
+    RefNode *n = slot;
+    if (!n || l >= r) return 0;
+    int mid = run_lower_bound(keys, l, r, n->key);
+    bool hit = mid < r && keys[mid] == n->key;
+    int removed = ref_erase_run(n->left, keys, l, mid) +
+                  ref_erase_run(n->right, keys, hit ? mid + 1 : mid, r);
+    n->size -= removed;
+    if (!hit) return removed;
+    // detach the children so the join only touches their own ancestors
+    if (n->left) n->left->parent = nullptr;
+    if (n->right) n->right->parent = nullptr;
+    RefNode *j = ref_join(n->left, n->right);
+    if (j) j->parent = n->parent;
+    // j takes n's place on a preferred path
+    if (n->parent && n->parent->preferred == n) n->parent->preferred = j;
+    slot = j;
+    delete n;
+    return removed + 1;
+}
+
 // Collect the root→target path, return length
 int collect_path(RefNode *root, RefNode *target, RefNode **out_arr, int maxn) {
     int idx = 0;
@@ -302,28 +748,9 @@ int collect_path(RefNode *root, RefNode *target, RefNode **out_arr, int maxn) {
 }
 
 //update preferred pointers
-void set_preferred_along_path(RefNode *root, RefNode **path, int len) {
-    struct ClearStack { RefNode* n; ClearStack* next; ClearStack(RefNode* x):n(x),next(nullptr){} };
-    ClearStack *stack = nullptr;
-    if (root) {
-        stack = new ClearStack(root);
-    }
-    while (stack) {
-        ClearStack *top = stack;
-        RefNode *n = top->n;
-        stack = stack->next;
-        n->preferred = nullptr;
-        if (n->left) {
-            ClearStack *s = new ClearStack(n->left);
-            s->next = stack; stack = s;
-        }
-        if (n->right) {
-            ClearStack *s = new ClearStack(n->right);
-            s->next = stack; stack = s;
-        }
-        delete top;
-    }
-
+// Only nodes on the path change, O(depth); every other node keeps the child
+// toward its last accessed descendant as preferred, as in Tango.
+void set_preferred_along_path(RefNode **path, int len) {
     //Set preferred pointers along the path
     for (int i = 0; i + 1 < len; ++i) {
         path[i]->preferred = path[i+1];
@@ -333,6 +760,26 @@ void set_preferred_along_path(RefNode *root, RefNode **path, int len) {
 
 struct AuxListNode { AuxNode* aroot; AuxListNode* next; AuxListNode(AuxNode* r): aroot(r), next(nullptr){} };
 
+// Aux tree of the preferred path that starts at 'head'
+AuxNode* build_aux_path(RefNode *head) {
+    int maxlen = 1024; // initial; if path longer, we'll reallocate
+    RefNode **arr = (RefNode**)malloc(sizeof(RefNode*) * maxlen);
+    int len = 0;
+    RefNode *cur = head;
+    while (cur) {
+        if (len >= maxlen) {
+            maxlen *= 2;
+            arr = (RefNode**)realloc(arr, sizeof(RefNode*) * maxlen);
+        }
+        arr[len++] = cur;
+        cur = cur->preferred;
+    }
+    // Build splay from arr[0..len-1] using merge-based builder
+    AuxNode *aroot = build_splay_from_array_with_merge(arr, 0, len-1);
+    free(arr);
+    return aroot;
+}
+
 AuxListNode* build_aux_trees_from_ref(RefNode *root) {
     if (!root) return nullptr;
     struct Stack { RefNode* n; Stack* next; Stack(RefNode* x):n(x),next(nullptr){} };
@@ -346,23 +793,8 @@ AuxListNode* build_aux_trees_from_ref(RefNode *root) {
         if (n->right) { Stack *s = new Stack(n->right); s->next = st; st = s; }
         if (n->left)  { Stack *s = new Stack(n->left);  s->next = st; st = s; }
         if (!n->parent || n->parent->preferred != n) {
-            int maxlen = 1024; // initial; if path longer, we'll reallocate
-            RefNode **arr = (RefNode**)malloc(sizeof(RefNode*) * maxlen);
-            int len = 0;
-            RefNode *cur = n;
-            while (cur) {
-                if (len >= maxlen) {
-                    maxlen *= 2;
-                    arr = (RefNode**)realloc(arr, sizeof(RefNode*) * maxlen);
-                }
-                arr[len++] = cur;
-                cur = cur->preferred;
-            }
-            // Build splay from arr[0..len-1] using merge-based builder
-            AuxNode *aroot = build_splay_from_array_with_merge(arr, 0, len-1);
-            AuxListNode *an = new AuxListNode(aroot);
+            AuxListNode *an = new AuxListNode(build_aux_path(n));
             an->next = alist; alist = an;
-            free(arr);
         }
         delete t;
     }
@@ -380,125 +812,2008 @@ void free_aux_list(AuxListNode *alist) {
     }
 }
 
-//Tango structure
-struct Tango {
-    RefNode *ref_root;
-    AuxListNode *aux_list;
-
-    Tango(): ref_root(nullptr), aux_list(nullptr) {}
-
-    void build_from_sorted_array(int *arr, int n) {
-        ref_root = build_ref_from_sorted(arr, 0, n-1);
-        // initially no preferred pointers
-        rebuild_aux();
-    }
+// In-order walk of one aux tree, which must follow the preferred path from
+// 'expect' down; counts the nodes seen
+bool aux_check_path(AuxNode *a, RefNode *&expect, int &count) {
+    if (!a) return true;
+    if (!aux_check_path(a->left, expect, count)) return false;
+    if (a->ref != expect || a->ref->aux_ptr != a) return false;
+    expect = a->ref->preferred;
+    count++;
+    return aux_check_path(a->right, expect, count);
+}
 
-    void rebuild_aux() {
-        // free previous aux trees
-        if (aux_list) {
-            free_aux_list(aux_list);
-            aux_list = nullptr;
-        }
-        aux_list = build_aux_trees_from_ref(ref_root);
+// True if every node of 'root' lies in exactly one aux tree of 'alist' and
+// each aux tree holds one whole preferred path in depth order
+bool aux_forest_check(RefNode *root, AuxListNode *alist) {
+    int count = 0;
+    for (AuxListNode *an = alist; an; an = an->next) {
+        if (!an->aroot) return false;
+        RefNode *head = aux_find_min(an->aroot)->ref;
+        if (head->parent && head->parent->preferred == head) return false;
+        RefNode *expect = head;
+        if (!aux_check_path(an->aroot, expect, count) || expect) return false;
     }
+    // aux_ptr admits one aux node per reference node, so no node is counted twice
+    return count == ref_size(root);
+}
 
-    // Access operation (Search): find node and update preferred path.
-    RefNode* access(int key) {
-        RefNode *target = bst_search(ref_root, key);
-        if (!target) {
-            return nullptr;
-        }
-        const int MAXP = 100000;
-        RefNode **path = (RefNode**)malloc(sizeof(RefNode*) * 1000);
-        int capacity = 1000;
-        int len = 0;
-        RefNode *cur = ref_root;
-        while (cur) {
-            if (len >= capacity) {
-                capacity *= 2;
-                path = (RefNode**)realloc(path, sizeof(RefNode*) * capacity);
-            }
-            path[len++] = cur;
-            if (cur->key == key) break;
-            if (key < cur->key) cur = cur->left;
-            else cur = cur->right;
-        }
-        // set preferred pointers along path
-        set_preferred_along_path(ref_root, path, len);
-        free(path);
-
-        // Rebuild auxiliary trees for new preferred decomposition
-        // NOTE: This is a full rebuild. With aux_split/aux_merge you can implement incremental update here.
-        rebuild_aux();
-        return target;
-    }
+// --- Local aux forest repair ---
+// Aux trees are ordered by depth along their path, not by key, so a split or
+// join cannot cut them with aux_split_by_key. Instead the trees holding the
+// few reference nodes that get relinked are released, and only the preferred
+// paths through those nodes are rebuilt.
 
-    // Insert key into reference tree, then rebuild aux
-    void insert_key(int key) {
-        RefNode *n = bst_insert(ref_root, key);
-        (void)n;
-        rebuild_aux();
-    }
+int cmp_ptr(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t)*(void* const*)a, y = (uintptr_t)*(void* const*)b;
+    return (x > y) - (x < y);
+}
 
-    // Remove key
-    void remove_key(int key) {
-        RefNode *z = bst_search(ref_root, key);
-        if (!z) return;
-        bst_delete(ref_root, z);
-        rebuild_aux();
+void aux_collect_refs(AuxNode *a, RefNode **&out, int &cnt, int &cap) {
+    if (!a) return;
+    aux_collect_refs(a->left, out, cnt, cap);
+    if (cnt >= cap) {
+        cap *= 2;
+        out = (RefNode**)realloc(out, sizeof(RefNode*) * cap);
     }
+    out[cnt++] = a->ref;
+    aux_collect_refs(a->right, out, cnt, cap);
+}
 
-    void print_ref_inorder(RefNode *r) {
-        if (!r) return;
-        print_ref_inorder(r->left);
-        printf("%d ", r->key);
-        print_ref_inorder(r->right);
+// Unlink from 'list' and free every aux tree that holds one of touched[0, n).
+// Returns the reference nodes of those trees (malloc'd, 'cnt' entries).
+RefNode** aux_list_release(AuxListNode *&list, RefNode **touched, int n, int &cnt) {
+    AuxNode **roots = (AuxNode**)malloc(sizeof(AuxNode*) * (n > 0 ? n : 1));
+    int nr = 0;
+    for (int i = 0; i < n; ++i) {
+        AuxNode *a = (AuxNode*)touched[i]->aux_ptr;
+        if (!a) continue;
+        while (a->parent) a = a->parent;
+        roots[nr++] = a;
     }
-    void print_ref_tree() { print_ref_inorder(ref_root); printf("\n"); }
-
-    void print_aux_trees() {
-        printf("Aux trees (roots):\n");
-        AuxListNode *cur = aux_list;
-        int idx = 0;
-        while (cur) {
-            printf("Aux %d: ", idx++);
-            print_aux_inorder(cur->aroot);
-            printf("\n");
-            cur = cur->next;
+    qsort(roots, nr, sizeof(AuxNode*), cmp_ptr);
+    int k = 0;
+    for (int i = 0; i < nr; ++i)
+        if (k == 0 || roots[k-1] != roots[i]) roots[k++] = roots[i];
+    nr = k;
+
+    int cap = 64;
+    cnt = 0;
+    RefNode **nodes = (RefNode**)malloc(sizeof(RefNode*) * cap);
+    for (int i = 0; i < nr; ++i) aux_collect_refs(roots[i], nodes, cnt, cap);
+
+    int left = nr;
+    AuxListNode **link = &list;
+    while (*link && left > 0) {
+        AuxListNode *an = *link;
+        if (bsearch(&an->aroot, roots, nr, sizeof(AuxNode*), cmp_ptr)) {
+            *link = an->next;
+            free_aux_tree(an->aroot);
+            delete an;
+            left--;
+        } else {
+            link = &an->next;
         }
     }
+    free(roots);
+    return nodes;
+}
 
-private:
-    void print_ref_inorder(RefNode *r, int depth) {
-        (void)depth;
-        if (!r) return;
-        print_ref_inorder(r->left, depth+1);
-        printf("%d ", r->key);
-        print_ref_inorder(r->right, depth+1);
+// Prepend aux trees for the preferred paths headed by any of nodes[0, cnt)
+void aux_list_add_paths(AuxListNode *&list, RefNode **nodes, int cnt) {
+    for (int i = 0; i < cnt; ++i) {
+        RefNode *n = nodes[i];
+        if (n->parent && n->parent->preferred == n) continue;
+        AuxListNode *an = new AuxListNode(build_aux_path(n));
+        an->next = list;
+        list = an;
     }
+}
+
+// --- Incremental (deamortized) aux forest rebuild ---
+// A shadow forest is built a few nodes per step, in the same order and shape
+// as build_aux_trees_from_ref, and swapped in when complete. Replaced trees
+// are freed the same way. Freeing never touches AuxNode::ref: the RefNode may
+// already have been deleted.
+// Accesses keep changing preferred pointers while a build runs, so the build
+// reads them as of its start: each build has an epoch, and the first change
+// to a node's preferred child during that epoch saves the old one. Nodes
+// inserted meanwhile start with no preferred child and are either visited
+// as one-node paths or picked up by the next build.
+struct AuxRebuild {
+    struct Stack { RefNode* n; Stack* next; Stack(RefNode* x):n(x),next(nullptr){} };
+    struct Retired { AuxListNode* list; Retired* next; Retired(AuxListNode* l):list(l),next(nullptr){} };
+
+    bool running;
+    bool dirty;            // preferred paths changed since this build started
+    uint32_t epoch;        // tags preferred pointers saved for this build
+    Stack *st;             // reference nodes still to visit
+    RefNode *path_cur;     // next node of the preferred path being converted
+    AuxNode *path_root;    // aux tree of that path so far
+    AuxListNode *shadow;   // finished aux trees
+    Retired *retired;      // aux lists waiting to be freed
+    AuxNode *freeing;      // tree currently being freed
+
+    AuxRebuild(): running(false), dirty(false), epoch(0), st(nullptr), path_cur(nullptr), path_root(nullptr),
+                  shadow(nullptr), retired(nullptr), freeing(nullptr) {}
 };
 
-int main() {
-    // Build Tango from sorted keys
-    int keys[] = {10, 20, 30, 40, 50, 60, 70};
-    int n = sizeof(keys)/sizeof(keys[0]);
+void rebuild_retire(AuxRebuild &rb, AuxListNode *list) {
+    if (!list) return;
+    AuxRebuild::Retired *r = new AuxRebuild::Retired(list);
+    r->next = rb.retired;
+    rb.retired = r;
+}
 
-    Tango T;
-    T.build_from_sorted_array(keys, n);
+// Epochs are drawn from one counter: split and join move nodes between trees
+uint32_t rebuild_epochs = 0;
 
-    printf("Initial reference tree inorder: ");
-    T.print_ref_tree();
-    T.print_aux_trees();
+void rebuild_start(AuxRebuild &rb, RefNode *root) {
+    rb.running = true;
+    rb.dirty = false;
+    rb.epoch = ++rebuild_epochs;
+    rb.st = root ? new AuxRebuild::Stack(root) : nullptr;
+}
 
-    printf("\nAccess 50\n");
-    T.access(50);
-    T.print_aux_trees();
+// Preferred child of 'n' when the running build started
+RefNode* rebuild_pref(const AuxRebuild &rb, RefNode *n) {
+    return n->pref_epoch == rb.epoch ? n->saved_pref : n->preferred;
+}
 
-    printf("\nAccess 20\n");
-    T.access(20);
-    T.print_aux_trees();
+void rebuild_save_one(AuxRebuild &rb, RefNode *n) {
+    if (n->pref_epoch == rb.epoch) return;
+    n->saved_pref = n->preferred;
+    n->pref_epoch = rb.epoch;
+}
 
-    printf("\nInsert 25\n");
+// Called before set_preferred_along_path(path, len): keep the build's view
+// of the preferred pointers about to change, which are the path's, O(depth).
+void rebuild_save_preferred(AuxRebuild &rb, RefNode **path, int len) {
+    if (!rb.running) return;
+    for (int i = 0; i < len; ++i) rebuild_save_one(rb, path[i]);
+}
+
+// Abandon a build in progress (e.g. before reference nodes are freed)
+void rebuild_abort(AuxRebuild &rb) {
+    while (rb.st) {
+        AuxRebuild::Stack *t = rb.st;
+        rb.st = t->next;
+        delete t;
+    }
+    if (rb.path_root) rebuild_retire(rb, new AuxListNode(rb.path_root));
+    rebuild_retire(rb, rb.shadow);
+    rb.path_root = nullptr;
+    rb.path_cur = nullptr;
+    rb.shadow = nullptr;
+    rb.running = false;
+    rb.dirty = false;
+}
+
+// One unit of build work: visit one reference node or add one node to the
+// current path's aux tree. Returns true once the shadow forest is complete.
+bool rebuild_build_unit(AuxRebuild &rb) {
+    if (rb.path_cur) {
+        AuxNode *a = new AuxNode(rb.path_cur);
+        rb.path_cur->aux_ptr = a;
+        if (rb.path_root) {
+            // same as aux_merge(path_root, a); the max is at most one step down
+            AuxNode *m = splay(aux_find_max(rb.path_root));
+            m->right = a;
+            a->parent = m;
+            rb.path_root = m;
+        } else {
+            rb.path_root = a;
+        }
+        rb.path_cur = rebuild_pref(rb, rb.path_cur);
+        if (!rb.path_cur) {
+            AuxListNode *an = new AuxListNode(rb.path_root);
+            an->next = rb.shadow;
+            rb.shadow = an;
+            rb.path_root = nullptr;
+        }
+        return false;
+    }
+    if (!rb.st) return true;
+    AuxRebuild::Stack *t = rb.st;
+    RefNode *n = t->n;
+    rb.st = t->next;
+    delete t;
+    if (n->right) { AuxRebuild::Stack *s = new AuxRebuild::Stack(n->right); s->next = rb.st; rb.st = s; }
+    if (n->left)  { AuxRebuild::Stack *s = new AuxRebuild::Stack(n->left);  s->next = rb.st; rb.st = s; }
+    if (!n->parent || rebuild_pref(rb, n->parent) != n) rb.path_cur = n;
+    return false;
+}
+
+// One unit of freeing (rotations flatten the tree, so no stack is needed).
+// Returns false when nothing is left to free.
+bool rebuild_free_unit(AuxRebuild &rb) {
+    if (!rb.freeing) {
+        if (!rb.retired) return false;
+        AuxListNode *an = rb.retired->list;
+        rb.freeing = an->aroot;
+        rb.retired->list = an->next;
+        delete an;
+        if (!rb.retired->list) {
+            AuxRebuild::Retired *r = rb.retired;
+            rb.retired = r->next;
+            delete r;
+        }
+        if (!rb.freeing) return true;
+    }
+    AuxNode *a = rb.freeing;
+    if (a->left) {
+        AuxNode *l = a->left;
+        a->left = l->right;
+        l->right = a;
+        rb.freeing = l;
+    } else {
+        rb.freeing = a->right;
+        delete a;
+    }
+    return true;
+}
+
+// Spend at most 'units' of build and free work. A finished shadow forest
+// replaces 'live'; if paths changed meanwhile, the next build starts at once.
+void rebuild_step(AuxRebuild &rb, AuxListNode *&live, RefNode *root, int units) {
+    while (units > 0) {
+        bool did = false;
+        if (rb.running) {
+            did = true;
+            units--;
+            if (rebuild_build_unit(rb)) {
+                rebuild_retire(rb, live);
+                live = rb.shadow;
+                rb.shadow = nullptr;
+                rb.running = false;
+                if (rb.dirty) rebuild_start(rb, root);
+            }
+        }
+        if (units > 0 && rebuild_free_unit(rb)) {
+            did = true;
+            units--;
+        }
+        if (!did) break;
+    }
+}
+
+// Hand the pending frees of 'src' (which must not be building) to 'dst'
+void rebuild_adopt(AuxRebuild &dst, AuxRebuild &src) {
+    if (src.freeing) rebuild_retire(dst, new AuxListNode(src.freeing));
+    src.freeing = nullptr;
+    while (src.retired) {
+        AuxRebuild::Retired *r = src.retired;
+        src.retired = r->next;
+        r->next = dst.retired;
+        dst.retired = r;
+    }
+}
+
+bool rebuild_idle(const AuxRebuild &rb) {
+    return !rb.running && !rb.retired && !rb.freeing;
+}
+
+// Free a reference subtree
+void free_ref_tree(RefNode *r) {
+    if (!r) return;
+    free_ref_tree(r->left);
+    free_ref_tree(r->right);
+    delete r;
+}
+
+// --- Binary snapshot of the reference tree ---
+// Layout: SnapHeader followed by 'count' SnapNode records in preorder.
+// Links are record indices (-1 for none), so the image is position-independent
+// and can be searched straight out of an mmap'd file.
+const char SNAP_MAGIC[8] = {'T','A','N','G','O','S','N','P'};
+const uint32_t SNAP_VERSION = 1;
+const uint32_t SNAP_PREF_LEFT = 1;
+const uint32_t SNAP_PREF_RIGHT = 2;
+
+struct SnapHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t node_size;
+    int32_t count;
+    int32_t root;
+};
+
+struct SnapNode {
+    int32_t key;
+    int32_t left, right, parent;
+    uint32_t flags;   // SNAP_PREF_LEFT / SNAP_PREF_RIGHT: preferred child bit
+};
+
+// Append 'n' and its subtree in preorder, return its record index
+int32_t snapshot_fill(RefNode *n, int32_t parent, SnapNode *out, int32_t &count) {
+    if (!n) return -1;
+    int32_t idx = count++;
+    out[idx].key = n->key;
+    out[idx].parent = parent;
+    out[idx].flags = 0;
+    if (n->preferred && n->preferred == n->left) out[idx].flags |= SNAP_PREF_LEFT;
+    if (n->preferred && n->preferred == n->right) out[idx].flags |= SNAP_PREF_RIGHT;
+    out[idx].left = snapshot_fill(n->left, idx, out, count);
+    out[idx].right = snapshot_fill(n->right, idx, out, count);
+    return idx;
+}
+
+int ref_count_nodes(RefNode *r) {
+    if (!r) return 0;
+    return 1 + ref_count_nodes(r->left) + ref_count_nodes(r->right);
+}
+
+// Write a snapshot of 'root' to 'path'. Returns false on I/O failure.
+bool snapshot_save(RefNode *root, const char *path) {
+    int n = ref_count_nodes(root);
+    SnapNode *nodes = (SnapNode*)malloc(sizeof(SnapNode) * (n > 0 ? n : 1));
+    int32_t count = 0;
+    SnapHeader h;
+    memcpy(h.magic, SNAP_MAGIC, sizeof(h.magic));
+    h.version = SNAP_VERSION;
+    h.node_size = sizeof(SnapNode);
+    h.root = snapshot_fill(root, -1, nodes, count);
+    h.count = count;
+
+    FILE *f = fopen(path, "wb");
+    bool ok = f != nullptr;
+    if (ok) ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    if (ok && count > 0) ok = fwrite(nodes, sizeof(SnapNode), count, f) == (size_t)count;
+    if (f && fclose(f) != 0) ok = false;
+    free(nodes);
+    return ok;
+}
+
+// Read-only mapping of a snapshot file
+struct SnapshotView {
+    void *base;
+    size_t len;
+    const SnapHeader *hdr;
+    const SnapNode *nodes;
+    SnapshotView(): base(nullptr), len(0), hdr(nullptr), nodes(nullptr) {}
+};
+
+// mmap 'path' and validate the header; pages are faulted in on demand.
+bool snapshot_open(const char *path, SnapshotView &v) {
+    v = SnapshotView();
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SnapHeader)) {
+        close(fd);
+        return false;
+    }
+    void *base = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return false;
+    const SnapHeader *h = (const SnapHeader*)base;
+    size_t need = sizeof(SnapHeader) + (size_t)(h->count > 0 ? h->count : 0) * sizeof(SnapNode);
+    if (memcmp(h->magic, SNAP_MAGIC, sizeof(h->magic)) != 0 || h->version != SNAP_VERSION ||
+        h->node_size != sizeof(SnapNode) || h->count < 0 || (size_t)st.st_size < need ||
+        h->root < -1 || h->root >= h->count) {
+        munmap(base, st.st_size);
+        return false;
+    }
+    v.base = base;
+    v.len = st.st_size;
+    v.hdr = h;
+    v.nodes = (const SnapNode*)((const char*)base + sizeof(SnapHeader));
+    return true;
+}
+
+void snapshot_close(SnapshotView &v) {
+    if (v.base) munmap(v.base, v.len);
+    v = SnapshotView();
+}
+
+// Search the mapped image directly, return record index or -1. Links are
+// checked as they are followed: a child must come after its parent (preorder),
+// so a damaged file can neither index out of the mapping nor loop.
+int32_t snapshot_search(const SnapshotView &v, int key) {
+    if (!v.hdr) return -1;
+    int32_t count = v.hdr->count;
+    int32_t cur = v.hdr->root;
+    while (cur >= 0 && cur < count) {
+        const SnapNode &n = v.nodes[cur];
+        if (key == n.key) return cur;
+        int32_t next = key < n.key ? n.left : n.right;
+        if (next >= 0 && next <= cur) return -1;
+        cur = next;
+    }
+    return -1;
+}
+
+// Materialize a pointer-based reference tree (with preferred children) from a view
+RefNode* snapshot_to_ref(const SnapshotView &v) {
+    int32_t count = v.hdr ? v.hdr->count : 0;
+    int32_t root_idx = v.hdr ? v.hdr->root : -1;
+    if (count <= 0 || root_idx < 0 || root_idx >= count) return nullptr;
+    RefNode **map = (RefNode**)malloc(sizeof(RefNode*) * count);
+    for (int32_t i = 0; i < count; ++i) map[i] = new RefNode(v.nodes[i].key);
+    for (int32_t i = 0; i < count; ++i) {
+        const SnapNode &s = v.nodes[i];
+        RefNode *n = map[i];
+        // a child must follow its parent (preorder) and name it as parent, so
+        // a damaged file cannot produce a cycle or a node with two parents
+        if (s.left > i && s.left < count && v.nodes[s.left].parent == i) {
+            n->left = map[s.left];
+            n->left->parent = n;
+        }
+        if (s.right > i && s.right < count && s.right != s.left && v.nodes[s.right].parent == i) {
+            n->right = map[s.right];
+            n->right->parent = n;
+        }
+        if (s.flags & SNAP_PREF_LEFT) n->preferred = n->left;
+        else if (s.flags & SNAP_PREF_RIGHT) n->preferred = n->right;
+    }
+    RefNode *root = map[root_idx];
+    if (root->parent) {
+        if (root->parent->left == root) root->parent->left = nullptr;
+        else root->parent->right = nullptr;
+        if (root->parent->preferred == root) root->parent->preferred = nullptr;
+        root->parent = nullptr;
+    }
+    // drop records the root cannot reach; a linked child has a larger index
+    bool *reach = (bool*)calloc(count, sizeof(bool));
+    reach[root_idx] = true;
+    for (int32_t i = 0; i < count; ++i) {
+        if (!reach[i]) continue;
+        if (map[i]->left) reach[v.nodes[i].left] = true;
+        if (map[i]->right) reach[v.nodes[i].right] = true;
+    }
+    for (int32_t i = count - 1; i >= 0; --i) {
+        if (reach[i]) map[i]->size = 1 + ref_size(map[i]->left) + ref_size(map[i]->right);
+        else delete map[i];
+    }
+    free(reach);
+    free(map);
+    return root;
+}
+
+// --- Operation trace capture ---
+// File: 8-byte magic + uint32 version, then 5-byte records (op byte, int32 key).
+// TRACE_LOAD records come first and list the starting key set in order.
+// TRACE_SELECT carries the rank k in the key field. TRACE_INSERT_RANGE and
+// TRACE_ERASE_RANGE carry the run length m and are followed by m
+// TRACE_RUN_KEY records holding the run. Version 2 added TRACE_RANK /
+// TRACE_SELECT and version 3 the range ops; older files are still readable.
+const char TRACE_MAGIC[8] = {'T','A','N','G','O','T','R','C'};
+const uint32_t TRACE_VERSION = 3;
+enum TraceOp : uint8_t { TRACE_LOAD = 0, TRACE_ACCESS = 1, TRACE_INSERT = 2, TRACE_REMOVE = 3,
+                         TRACE_RANK = 4, TRACE_SELECT = 5, TRACE_INSERT_RANGE = 6,
+                         TRACE_ERASE_RANGE = 7, TRACE_RUN_KEY = 8 };
+const int TRACE_OPS = 9;
+
+struct TraceEvent {
+    uint8_t op;
+    int32_t key;
+};
+
+struct TraceWriter {
+    FILE *f;
+    long count;    // records passed to stdio without error
+    bool failed;   // a write failed; later records are dropped
+    TraceWriter(): f(nullptr), count(0), failed(false) {}
+};
+
+bool trace_open(TraceWriter &tw, const char *path) {
+    tw.count = 0;
+    tw.failed = false;
+    tw.f = fopen(path, "wb");
+    if (!tw.f) return false;
+    if (fwrite(TRACE_MAGIC, sizeof(TRACE_MAGIC), 1, tw.f) != 1 ||
+        fwrite(&TRACE_VERSION, sizeof(TRACE_VERSION), 1, tw.f) != 1) {
+        fclose(tw.f);
+        tw.f = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void trace_record(TraceWriter *tw, uint8_t op, int key) {
+    if (!tw || !tw->f || tw->failed) return;
+    unsigned char rec[5];
+    int32_t k = key;
+    rec[0] = op;
+    memcpy(rec + 1, &k, sizeof(k));
+    if (fwrite(rec, sizeof(rec), 1, tw->f) != 1) {
+        tw->failed = true;
+        return;
+    }
+    tw->count++;
+}
+
+// Record the keys of 'r' as 'op' events (in-order)
+void trace_record_keys(TraceWriter *tw, RefNode *r, uint8_t op) {
+    if (!r) return;
+    trace_record_keys(tw, r->left, op);
+    trace_record(tw, op, r->key);
+    trace_record_keys(tw, r->right, op);
+}
+
+// Record the keys of 'r' as one TRACE_INSERT_RANGE / TRACE_ERASE_RANGE
+void trace_record_run(TraceWriter *tw, uint8_t op, RefNode *r) {
+    if (!tw || !r) return;
+    trace_record(tw, op, ref_size(r));
+    trace_record_keys(tw, r, TRACE_RUN_KEY);
+}
+
+// False if any record was lost, including on the final flush; the file then
+// holds at most the first tw.count records
+bool trace_close(TraceWriter &tw) {
+    bool ok = tw.f && fclose(tw.f) == 0 && !tw.failed;
+    tw.f = nullptr;
+    return ok;
+}
+
+// Read a whole trace into a malloc'd array; returns nullptr on error
+TraceEvent* trace_load(const char *path, long &n) {
+    n = 0;
+    FILE *f = fopen(path, "rb");
+    if (!f) return nullptr;
+    char magic[8];
+    uint32_t version = 0;
+    if (fread(magic, sizeof(magic), 1, f) != 1 || memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0 ||
+        fread(&version, sizeof(version), 1, f) != 1 || version < 1 || version > TRACE_VERSION) {
+        fclose(f);
+        return nullptr;
+    }
+    long capacity = 1024;
+    TraceEvent *ev = (TraceEvent*)malloc(sizeof(TraceEvent) * capacity);
+    unsigned char rec[5];
+    while (fread(rec, sizeof(rec), 1, f) == 1) {
+        if (n >= capacity) {
+            capacity *= 2;
+            ev = (TraceEvent*)realloc(ev, sizeof(TraceEvent) * capacity);
+        }
+        ev[n].op = rec[0];
+        memcpy(&ev[n].key, rec + 1, sizeof(int32_t));
+        n++;
+    }
+    fclose(f);
+    return ev;
+}
+
+// --- Hot-key front cache ---
+// Set-associative cache of key -> RefNode in front of Tango::access. Each set
+// is one cache line holding HOT_WAYS entries, most recently inserted first;
+// an empty way has node == nullptr.
+const int HOT_WAYS = 4;
+
+struct alignas(64) HotSet {
+    int keys[HOT_WAYS];
+    RefNode *nodes[HOT_WAYS];
+};
+
+struct HotCache {
+    HotSet *sets;
+    uint32_t mask;           // number of sets - 1
+    uint32_t sample_every;   // every n-th hit still goes through the tree (0: never)
+    uint32_t since_sample;
+    long long hits, misses;
+};
+
+// 'nsets' is rounded up to a power of two
+HotCache* hot_cache_create(int nsets, int sample_every) {
+    uint32_t n = 1;
+    while ((int)n < nsets) n <<= 1;
+    HotCache *c = new HotCache;
+    c->sets = (HotSet*)aligned_alloc(alignof(HotSet), sizeof(HotSet) * n);
+    memset(c->sets, 0, sizeof(HotSet) * n);
+    c->mask = n - 1;
+    c->sample_every = sample_every > 0 ? (uint32_t)sample_every : 0;
+    c->since_sample = 0;
+    c->hits = c->misses = 0;
+    return c;
+}
+
+void hot_cache_destroy(HotCache *c) {
+    if (!c) return;
+    free(c->sets);
+    delete c;
+}
+
+HotSet* hot_cache_set(HotCache *c, int key) {
+    uint32_t h = (uint32_t)key * 0x9E3779B1u;
+    h ^= h >> 16;
+    return &c->sets[h & c->mask];
+}
+
+RefNode* hot_cache_lookup(HotCache *c, int key) {
+    HotSet *s = hot_cache_set(c, key);
+    for (int i = 0; i < HOT_WAYS; ++i) {
+        if (s->nodes[i] && s->keys[i] == key) {
+            c->hits++;
+            return s->nodes[i];
+        }
+    }
+    c->misses++;
+    return nullptr;
+}
+
+// True when this hit should still be fed to the adaptive structure
+bool hot_cache_sample(HotCache *c) {
+    if (c->sample_every == 0) return false;
+    if (++c->since_sample < c->sample_every) return false;
+    c->since_sample = 0;
+    return true;
+}
+
+void hot_cache_insert(HotCache *c, int key, RefNode *node) {
+    HotSet *s = hot_cache_set(c, key);
+    int i = 0;
+    while (i < HOT_WAYS && !(s->nodes[i] && s->keys[i] == key)) ++i;
+    if (i == HOT_WAYS) {
+        // not cached: take the first empty way, else the oldest
+        i = 0;
+        while (i < HOT_WAYS - 1 && s->nodes[i]) ++i;
+    }
+    // shift ways [0, i) down by one, overwriting way i
+    for (; i > 0; --i) {
+        s->keys[i] = s->keys[i-1];
+        s->nodes[i] = s->nodes[i-1];
+    }
+    s->keys[0] = key;
+    s->nodes[0] = node;
+}
+
+void hot_cache_invalidate(HotCache *c, int key) {
+    if (!c) return;
+    HotSet *s = hot_cache_set(c, key);
+    for (int i = 0; i < HOT_WAYS; ++i) {
+        if (s->nodes[i] && s->keys[i] == key) s->nodes[i] = nullptr;
+    }
+}
+
+void hot_cache_clear(HotCache *c) {
+    if (c) memset(c->sets, 0, sizeof(HotSet) * (c->mask + 1));
+}
+
+// Cost counters for an instance
+struct TangoStats {
+    long long accesses;       // successful accesses
+    long long order_queries;  // rank/select calls
+    long long ref_nodes;      // reference-tree nodes on the accessed paths
+    long long pref_switches;  // preferred-child changes (the Tango cost term)
+    double model_cost;        // sum over accesses of (switches + 1) * tango_switch_cost(n)
+    TangoStats(): accesses(0), order_queries(0), ref_nodes(0), pref_switches(0), model_cost(0) {}
+};
+
+// Cost of one preferred-path segment in the Tango model: each aux tree holds
+// a path of O(log n) nodes, so searching it costs about 1 + lg lg n
+double tango_switch_cost(int n) {
+    double lg = n > 2 ? log2((double)n) : 1;
+    return 1 + log2(lg);
+}
+
+//Tango structure
+struct Tango {
+    RefNode *ref_root;
+    AuxListNode *aux_list;
+    TraceWriter *trace;
+    HotCache *hot;
+    TangoStats stats;
+    int rebuild_budget;   // max aux rebuild work per operation; 0 rebuilds eagerly
+    AuxRebuild rebuild;
+    LeafBlock *blocks;
+    SnapshotView snap;    // loaded snapshot, until the first operation that needs ref_root
+
+    Tango(): ref_root(nullptr), aux_list(nullptr), trace(nullptr), hot(nullptr), rebuild_budget(0),
+             blocks(nullptr) {}
+
+    // A trace logs a rebuild as erasing every old key and inserting the new
+    // ones, which replays to the same balanced tree.
+    void build_from_sorted_array(int *arr, int n) {
+        trace_record_run(trace, TRACE_ERASE_RANGE, ref_root);
+        clear();
+        ref_root = build_ref_from_sorted(arr, 0, n-1);
+        trace_record_run(trace, TRACE_INSERT_RANGE, ref_root);
+        // initially no preferred pointers
+        rebuild_aux();
+    }
+
+    // Shape the reference tree by known access weights instead of the midpoint
+    // (a trace replays it with the same keys, but the balanced shape)
+    void build_from_weighted_array(int *arr, double *w, int n) {
+        trace_record_run(trace, TRACE_ERASE_RANGE, ref_root);
+        clear();
+        ref_root = build_ref_from_weights(arr, w, n);
+        trace_record_run(trace, TRACE_INSERT_RANGE, ref_root);
+        rebuild_aux();
+    }
+
+    void rebuild_aux() {
+        if (rebuild_budget > 0) {
+            // incremental: aux_list may lag the preferred paths by one rebuild
+            if (rebuild.running) rebuild.dirty = true;
+            else rebuild_start(rebuild, ref_root);
+            rebuild_step(rebuild, aux_list, ref_root, rebuild_budget);
+            return;
+        }
+        // free previous aux trees
+        if (aux_list) {
+            free_aux_list(aux_list);
+            aux_list = nullptr;
+        }
+        aux_list = build_aux_trees_from_ref(ref_root);
+    }
+
+    // Access operation (Search): find node and update preferred path.
+    RefNode* access(int key) {
+        materialize();
+        trace_record(trace, TRACE_ACCESS, key);
+        if (hot) {
+            // A hit skips the search; a sampled one still updates preferred paths
+            RefNode *h = hot_cache_lookup(hot, key);
+            if (h) {
+                stats.accesses++;
+                if (hot_cache_sample(hot)) prefer_path_to(key);
+                return h;
+            }
+        }
+        // the path walk is the search; leaf blocks would not save it
+        RefNode *target = prefer_path_to(key);
+        if (!target) {
+            return nullptr;
+        }
+        stats.accesses++;
+        if (hot) hot_cache_insert(hot, key, target);
+        return target;
+    }
+
+    // Make the root -> key search path preferred and rebuild the aux forest.
+    // Returns the node holding key; if there is none, nothing changes.
+    // Eager mode (rebuild_budget 0) rebuilds the whole forest here, O(n); a
+    // budget bounds that to O(depth + budget) per call.
+    RefNode* prefer_path_to(int key) {
+        RefNode **path = (RefNode**)malloc(sizeof(RefNode*) * 1000);
+        int capacity = 1000;
+        int len = 0;
+        RefNode *cur = ref_root;
+        while (cur) {
+            if (len >= capacity) {
+                capacity *= 2;
+                path = (RefNode**)realloc(path, sizeof(RefNode*) * capacity);
+            }
+            path[len++] = cur;
+            if (cur->key == key) break;
+            if (key < cur->key) cur = cur->left;
+            else cur = cur->right;
+        }
+        if (!cur) {
+            free(path);
+            return nullptr;
+        }
+        int switches = 0;
+        for (int i = 0; i + 1 < len; ++i) {
+            if (path[i]->preferred != path[i+1]) switches++;
+        }
+        stats.ref_nodes += len;
+        stats.pref_switches += switches;
+        stats.model_cost += (switches + 1) * tango_switch_cost(ref_size(ref_root));
+        // set preferred pointers along path
+        rebuild_save_preferred(rebuild, path, len);
+        set_preferred_along_path(path, len);
+        free(path);
+
+        // Rebuild auxiliary trees for new preferred decomposition
+        // NOTE: This is a full rebuild. With aux_split/aux_merge you can implement incremental update here.
+        rebuild_aux();
+        return cur;
+    }
+
+    // Number of keys < key. The search takes O(depth); making the search
+    // path preferred costs what prefer_path_to does: O(n) in eager mode,
+    // O(depth + budget) after set_rebuild_budget.
+    int rank(int key) {
+        materialize();
+        trace_record(trace, TRACE_RANK, key);
+        stats.order_queries++;
+        int r = 0;
+        RefNode *cur = ref_root, *last = nullptr;
+        while (cur) {
+            last = cur;
+            if (key <= cur->key) {
+                if (key == cur->key) { r += ref_size(cur->left); break; }
+                cur = cur->left;
+            } else {
+                r += 1 + ref_size(cur->left);
+                cur = cur->right;
+            }
+        }
+        if (last) prefer_path_to(last->key);
+        return r;
+    }
+
+    // k-th smallest key (0-based), nullptr if out of range. Same cost as
+    // rank(): O(depth) to find it, plus prefer_path_to for the path to it.
+    RefNode* select(int k) {
+        materialize();
+        trace_record(trace, TRACE_SELECT, k);
+        stats.order_queries++;
+        if (k < 0 || k >= ref_size(ref_root)) return nullptr;
+        RefNode *cur = ref_root;
+        while (cur) {
+            int ls = ref_size(cur->left);
+            if (k == ls) break;
+            if (k < ls) {
+                cur = cur->left;
+            } else {
+                k -= ls + 1;
+                cur = cur->right;
+            }
+        }
+        if (cur) prefer_path_to(cur->key);
+        return cur;
+    }
+
+    // Put a front cache of 'sets' cache lines in front of access(); one in
+    // every 'sample_every' hits still updates preferred paths (0: none do).
+    void enable_hot_cache(int sets, int sample_every) {
+        hot_cache_destroy(hot);
+        hot = hot_cache_create(sets, sample_every);
+    }
+
+    void disable_hot_cache() {
+        hot_cache_destroy(hot);
+        hot = nullptr;
+    }
+
+    // Pack the bottom subtrees into LeafBlocks for faster find(); access()
+    // walks the path node by node anyway to update preferred children. Any
+    // change to the key set drops them; call again after bulk updates.
+    void build_leaf_blocks() {
+        materialize();
+        drop_leaf_blocks();
+        leaf_blocks_build(ref_root, blocks);
+    }
+
+    void drop_leaf_blocks() {
+        leaf_blocks_free(blocks);
+        blocks = nullptr;
+    }
+
+    // Read-only lookup; does not change preferred paths
+    RefNode* find(int key) {
+        materialize();
+        return blocks ? bst_search_blocked(ref_root, key) : bst_search(ref_root, key);
+    }
+
+    // Read-only batched lookup; does not change preferred paths
+    void lookup_batch(const int *keys, int n, RefNode **out) {
+        materialize();
+        bst_search_batch(ref_root, keys, n, out);
+    }
+
+    // Insert key into reference tree, then rebuild aux
+    void insert_key(int key) {
+        materialize();
+        trace_record(trace, TRACE_INSERT, key);
+        drop_leaf_blocks();
+        RefNode *n = bst_insert(ref_root, key);
+        (void)n;
+        rebuild_aux();
+    }
+
+    // Remove key
+    void remove_key(int key) {
+        materialize();
+        trace_record(trace, TRACE_REMOVE, key);
+        RefNode *z = bst_search(ref_root, key);
+        if (!z) return;
+        hot_cache_invalidate(hot, key);
+        drop_leaf_blocks();
+        // aux nodes reference z; drop them before z is freed
+        free_aux();
+        bst_delete(ref_root, z);
+        rebuild_aux();
+    }
+
+    // Insert a run of keys sorted ascending (duplicates and present keys are
+    // skipped) in one merge pass; the aux forest is rebuilt once at the end.
+    void insert_range(const int *keys, int m) {
+        if (m <= 0) return;
+        materialize();
+        trace_record(trace, TRACE_INSERT_RANGE, m);
+        int *run = (int*)malloc(sizeof(int) * m);
+        int u = 0;
+        for (int i = 0; i < m; ++i) {
+            assert(i == 0 || keys[i-1] <= keys[i]);
+            trace_record(trace, TRACE_RUN_KEY, keys[i]);
+            if (u == 0 || run[u-1] != keys[i]) run[u++] = keys[i];
+        }
+        drop_leaf_blocks();
+        ref_insert_run(ref_root, nullptr, run, 0, u);
+        free(run);
+        rebuild_aux();
+    }
+
+    // Remove a run of keys sorted ascending in one pass; absent keys are ignored
+    void erase_range(const int *keys, int m) {
+        if (m <= 0) return;
+        materialize();
+        trace_record(trace, TRACE_ERASE_RANGE, m);
+        for (int i = 0; i < m; ++i) {
+            assert(i == 0 || keys[i-1] <= keys[i]);
+            trace_record(trace, TRACE_RUN_KEY, keys[i]);
+            hot_cache_invalidate(hot, keys[i]);
+        }
+        drop_leaf_blocks();
+        // aux nodes reference the erased nodes; drop them first
+        free_aux();
+        ref_erase_run(ref_root, keys, 0, m);
+        rebuild_aux();
+    }
+
+    // Bound aux rebuild work to 'units' nodes per operation (0: eager, full
+    // rebuild every time). The forest is rebuilt in the background of later
+    // operations and swapped in when complete.
+    void set_rebuild_budget(int units) {
+        rebuild_budget = units > 0 ? units : 0;
+        if (rebuild_budget == 0) rebuild_finish();
+    }
+
+    // Complete any pending incremental rebuild and free retired trees
+    void rebuild_finish() {
+        while (!rebuild_idle(rebuild)) rebuild_step(rebuild, aux_list, ref_root, 1 << 20);
+    }
+
+    void free_aux() {
+        if (rebuild_budget > 0 || !rebuild_idle(rebuild)) {
+            // O(1) now; the trees are freed by later steps
+            rebuild_abort(rebuild);
+            rebuild_retire(rebuild, aux_list);
+            aux_list = nullptr;
+            if (rebuild_budget == 0) rebuild_finish();
+            return;
+        }
+        if (aux_list) {
+            free_aux_list(aux_list);
+            aux_list = nullptr;
+        }
+    }
+
+    // Drop all keys (the hot cache stays enabled, but empty)
+    void clear() {
+        snapshot_close(snap);
+        drop_leaf_blocks();
+        free_aux();
+        free_ref_tree(ref_root);
+        ref_root = nullptr;
+        hot_cache_clear(hot);
+    }
+
+    // Move keys <= key into 'left' and keys > key into 'right', leaving this
+    // tree empty. Previous contents of 'left' and 'right' are dropped.
+    // 'left' takes over this tree's trace, hot cache (emptied) and rebuild
+    // budget; 'right' gets the same budget and a new cache of the same shape,
+    // but no trace, since a trace follows a single tree. The trace logs the
+    // keys that moved to 'right' as one erase range.
+    // Only the aux trees on the cut path are rebuilt, unless a background
+    // rebuild is running (then both sides start a fresh one).
+    void split(int key, Tango &left, Tango &right) {
+        materialize();
+        left.clear();
+        right.clear();
+        left.disable_hot_cache();
+        right.disable_hot_cache();
+        drop_leaf_blocks();
+        hot_cache_clear(hot);
+        left.trace = trace;
+        right.trace = nullptr;
+        left.hot = hot;
+        if (hot) right.hot = hot_cache_create(hot->mask + 1, hot->sample_every);
+        trace = nullptr;
+        hot = nullptr;
+        RefNode *root = ref_root;
+        AuxListNode *forest = aux_list;
+        ref_root = nullptr;
+        aux_list = nullptr;
+        // when no build is running, the live forest matches the preferred paths
+        bool current = !rebuild.running;
+        if (!current) {
+            rebuild_abort(rebuild);
+            rebuild_retire(rebuild, forest);
+            forest = nullptr;
+        }
+        // this tree is left empty; its unfinished frees go with the budget
+        rebuild_adopt(left.rebuild, rebuild);
+        left.set_rebuild_budget(rebuild_budget);
+        right.set_rebuild_budget(rebuild_budget);
+
+        // ref_split relinks exactly the nodes on the search path for 'key'
+        int capacity = 64, len = 0;
+        RefNode **path = (RefNode**)malloc(sizeof(RefNode*) * capacity);
+        for (RefNode *cur = root; cur; cur = cur->key <= key ? cur->right : cur->left) {
+            if (len >= capacity) {
+                capacity *= 2;
+                path = (RefNode**)realloc(path, sizeof(RefNode*) * capacity);
+            }
+            path[len++] = cur;
+        }
+        int cnt = 0;
+        RefNode **nodes = current ? aux_list_release(forest, path, len, cnt) : nullptr;
+        RefNode *l, *r;
+        ref_split(root, key, l, r);
+        left.ref_root = l;
+        right.ref_root = r;
+        trace_record_run(left.trace, TRACE_ERASE_RANGE, r);
+        if (current) {
+            // every other aux tree lies wholly on one side
+            while (forest) {
+                AuxListNode *an = forest;
+                forest = an->next;
+                AuxListNode *&dst = an->aroot->ref->key <= key ? left.aux_list : right.aux_list;
+                an->next = dst;
+                dst = an;
+            }
+            int nl = 0;
+            for (int i = 0; i < cnt; ++i)
+                if (nodes[i]->key <= key) std::swap(nodes[i], nodes[nl++]);
+            aux_list_add_paths(left.aux_list, nodes, nl);
+            aux_list_add_paths(right.aux_list, nodes + nl, cnt - nl);
+        } else {
+            left.rebuild_aux();
+            right.rebuild_aux();
+        }
+        free(nodes);
+        free(path);
+    }
+
+    // Concatenate two key-disjoint trees (all keys of 'left' < all keys of
+    // 'right'); both are left empty. The result takes over the trace, hot
+    // cache and rebuild budget of 'left'; 'right' keeps its own.
+    // As with split, only the aux trees on the joined spine are rebuilt.
+    static Tango join(Tango &left, Tango &right) {
+        left.materialize();
+        right.materialize();
+        assert(!left.ref_root || !right.ref_root ||
+               bst_maximum(left.ref_root)->key < bst_minimum(right.ref_root)->key);
+        Tango t;
+        t.trace = left.trace;
+        t.hot = left.hot;   // entries stay valid: no node changes its key
+        // each trace sees the keys of 'right' arrive or leave as one range
+        trace_record_run(t.trace, TRACE_INSERT_RANGE, right.ref_root);
+        trace_record_run(right.trace, TRACE_ERASE_RANGE, right.ref_root);
+        left.trace = nullptr;
+        left.hot = nullptr;
+        left.drop_leaf_blocks();
+        right.drop_leaf_blocks();
+        hot_cache_clear(right.hot);
+        RefNode *l = left.ref_root, *r = right.ref_root;
+        AuxListNode *lf = left.aux_list, *rf = right.aux_list;
+        left.ref_root = right.ref_root = nullptr;
+        left.aux_list = right.aux_list = nullptr;
+        bool current = !left.rebuild.running && !right.rebuild.running;
+        if (!current) {
+            rebuild_abort(left.rebuild);
+            rebuild_abort(right.rebuild);
+            rebuild_retire(left.rebuild, lf);
+            rebuild_retire(right.rebuild, rf);
+            lf = rf = nullptr;
+        }
+        rebuild_adopt(t.rebuild, left.rebuild);
+        rebuild_adopt(t.rebuild, right.rebuild);
+        t.set_rebuild_budget(left.rebuild_budget);
+
+        // ref_join relinks the right spine of 'l' down to its maximum, and
+        // the maximum's left child
+        int capacity = 64, len = 0;
+        RefNode **spine = (RefNode**)malloc(sizeof(RefNode*) * capacity);
+        for (RefNode *cur = r ? l : nullptr; cur; cur = cur->right) {
+            if (len + 1 >= capacity) {
+                capacity *= 2;
+                spine = (RefNode**)realloc(spine, sizeof(RefNode*) * capacity);
+            }
+            spine[len++] = cur;
+            if (!cur->right && cur->left) spine[len++] = cur->left;
+        }
+        int cnt = 0;
+        RefNode **nodes = current ? aux_list_release(lf, spine, len, cnt) : nullptr;
+        t.ref_root = ref_join(l, r);
+        if (current) {
+            AuxListNode **tail = &lf;
+            while (*tail) tail = &(*tail)->next;
+            *tail = rf;
+            t.aux_list = lf;
+            aux_list_add_paths(t.aux_list, nodes, cnt);
+        } else {
+            t.rebuild_aux();
+        }
+        free(nodes);
+        free(spine);
+        return t;
+    }
+
+    // Start logging operations to 'tw' (nullptr stops). The current key set
+    // is written first so the trace can be replayed from scratch.
+    void set_trace(TraceWriter *tw) {
+        materialize();
+        trace = tw;
+        trace_record_keys(trace, ref_root, TRACE_LOAD);
+    }
+
+    // Persist the reference tree and its preferred-child bits
+    bool save_snapshot(const char *path) {
+        materialize();
+        return snapshot_save(ref_root, path);
+    }
+
+    // Replace the current contents with a snapshot. Only the file is mapped
+    // here: contains() is answered from the mapping, and the first operation
+    // that needs the pointer tree materializes it (O(n), once). A traced tree
+    // materializes at once, so the trace can log the key change as an erase
+    // and an insert range.
+    bool load_snapshot(const char *path) {
+        SnapshotView v;
+        if (!snapshot_open(path, v)) return false;
+        if (trace) {
+            materialize();
+            trace_record_run(trace, TRACE_ERASE_RANGE, ref_root);
+        }
+        clear();
+        snap = v;
+        if (trace) {
+            materialize();
+            trace_record_run(trace, TRACE_INSERT_RANGE, ref_root);
+        }
+        return true;
+    }
+
+    // Build ref_root and the aux forest from a loaded snapshot, if one is pending
+    void materialize() {
+        if (!snap.hdr) return;
+        ref_root = snapshot_to_ref(snap);
+        snapshot_close(snap);
+        rebuild_aux();
+    }
+
+    // Membership test that neither changes preferred paths nor materializes
+    bool contains(int key) {
+        if (snap.hdr) return snapshot_search(snap, key) >= 0;
+        return find(key) != nullptr;
+    }
+
+    void print_ref_inorder(RefNode *r) {
+        if (!r) return;
+        print_ref_inorder(r->left);
+        printf("%d ", r->key);
+        print_ref_inorder(r->right);
+    }
+    void print_ref_tree() { materialize(); print_ref_inorder(ref_root); printf("\n"); }
+
+    void print_aux_trees() {
+        materialize();
+        printf("Aux trees (roots):\n");
+        AuxListNode *cur = aux_list;
+        int idx = 0;
+        while (cur) {
+            printf("Aux %d: ", idx++);
+            print_aux_inorder(cur->aroot);
+            printf("\n");
+            cur = cur->next;
+        }
+    }
+
+private:
+    void print_ref_inorder(RefNode *r, int depth) {
+        (void)depth;
+        if (!r) return;
+        print_ref_inorder(r->left, depth+1);
+        printf("%d ", r->key);
+        print_ref_inorder(r->right, depth+1);
+    }
+};
+
+// --- String keys with an inline prefix ---
+// StrNode is a reference node keyed by a byte string. The first 8 bytes are
+// packed big-endian into 'prefix', so comparing prefixes as integers orders
+// keys like memcmp; the heap copy of the key is only read when prefixes tie.
+// RefNode::key holds the top 4 prefix bytes (sign-flipped to keep the order),
+// so most steps decide on the node's first cache line. All structural code
+// (aux forest, preferred paths, sizes, bst_unlink) works on StrNodes
+// unchanged; only searches differ.
+const int STR_PREFIX_BYTES = 8;
+
+struct StrNode : RefNode {
+    uint64_t prefix;
+    uint32_t len;
+    char *data;
+
+    StrNode(const char *s, uint32_t n);
+    ~StrNode() { free(data); }
+};
+
+uint64_t str_prefix(const char *s, uint32_t len) {
+    uint64_t p = 0;
+    for (int i = 0; i < STR_PREFIX_BYTES; ++i) {
+        p = (p << 8) | (uint64_t)(i < (int)len ? (unsigned char)s[i] : 0);
+    }
+    return p;
+}
+
+int str_prefix_key(uint64_t prefix) {
+    return (int)(int32_t)((uint32_t)(prefix >> 32) ^ 0x80000000u);
+}
+
+StrNode::StrNode(const char *s, uint32_t n) : RefNode(0), prefix(str_prefix(s, n)), len(n) {
+    key = str_prefix_key(prefix);
+    data = (char*)malloc(n > 0 ? n : 1);
+    memcpy(data, s, n);
+}
+
+// <0, 0, >0 as the probe (prefix, s, len) is below, equal to or above n
+int str_compare(uint64_t prefix, const char *s, uint32_t len, const StrNode *n) {
+    int k = str_prefix_key(prefix);
+    if (k != n->key) return k < n->key ? -1 : 1;
+    if (prefix != n->prefix) return prefix < n->prefix ? -1 : 1;
+    // equal prefixes: bytes [0, min(len, 8)) match, compare the rest
+    uint32_t m = len < n->len ? len : n->len;
+    if (m > STR_PREFIX_BYTES) {
+        int c = memcmp(s + STR_PREFIX_BYTES, n->data + STR_PREFIX_BYTES, m - STR_PREFIX_BYTES);
+        if (c) return c;
+    }
+    return (len > n->len) - (len < n->len);
+}
+
+StrNode* str_search(RefNode *root, const char *s, uint32_t len) {
+    uint64_t prefix = str_prefix(s, len);
+    RefNode *cur = root;
+    while (cur) {
+        int c = str_compare(prefix, s, len, (StrNode*)cur);
+        if (c == 0) return (StrNode*)cur;
+        cur = c < 0 ? cur->left : cur->right;
+    }
+    return nullptr;
+}
+
+// 'keys' sorted ascending (memcmp order), lens[i] bytes each
+RefNode* build_str_ref_from_sorted(const char **keys, const uint32_t *lens, int l, int r) {
+    if (l > r) return nullptr;
+    int mid = (l + r) / 2;
+    StrNode *node = new StrNode(keys[mid], lens[mid]);
+    node->left = build_str_ref_from_sorted(keys, lens, l, mid-1);
+    if (node->left) node->left->parent = node;
+    node->right = build_str_ref_from_sorted(keys, lens, mid+1, r);
+    if (node->right) node->right->parent = node;
+    node->size = 1 + ref_size(node->left) + ref_size(node->right);
+    return node;
+}
+
+void free_str_ref_tree(RefNode *r) {
+    if (!r) return;
+    free_str_ref_tree(r->left);
+    free_str_ref_tree(r->right);
+    delete (StrNode*)r;
+}
+
+// Tango over string keys. Lengths are explicit, so keys may contain any bytes.
+struct StrTango {
+    RefNode *ref_root;
+    AuxListNode *aux_list;
+
+    StrTango(): ref_root(nullptr), aux_list(nullptr) {}
+
+    void build_from_sorted_array(const char **keys, const uint32_t *lens, int n) {
+        clear();
+        ref_root = build_str_ref_from_sorted(keys, lens, 0, n-1);
+        rebuild_aux();
+    }
+
+    void rebuild_aux() {
+        free_aux();
+        aux_list = build_aux_trees_from_ref(ref_root);
+    }
+
+    void free_aux() {
+        if (aux_list) {
+            free_aux_list(aux_list);
+            aux_list = nullptr;
+        }
+    }
+
+    void clear() {
+        free_aux();
+        free_str_ref_tree(ref_root);
+        ref_root = nullptr;
+    }
+
+    // Read-only lookup
+    StrNode* find(const char *s, uint32_t len) {
+        return str_search(ref_root, s, len);
+    }
+
+    // Access: find the key and make its search path preferred
+    StrNode* access(const char *s, uint32_t len) {
+        StrNode *target = str_search(ref_root, s, len);
+        if (!target) return nullptr;
+        int capacity = 64, plen = 0;
+        RefNode **path = (RefNode**)malloc(sizeof(RefNode*) * capacity);
+        for (RefNode *c = target; c; c = c->parent) {
+            if (plen >= capacity) {
+                capacity *= 2;
+                path = (RefNode**)realloc(path, sizeof(RefNode*) * capacity);
+            }
+            path[plen++] = c;
+        }
+        // parent walk gives target -> root; set_preferred_along_path wants root first
+        for (int i = 0, j = plen - 1; i < j; ++i, --j) {
+            RefNode *t = path[i]; path[i] = path[j]; path[j] = t;
+        }
+        set_preferred_along_path(path, plen);
+        free(path);
+        rebuild_aux();
+        return target;
+    }
+
+    void insert_key(const char *s, uint32_t len) {
+        uint64_t prefix = str_prefix(s, len);
+        RefNode *cur = ref_root, *par = nullptr;
+        int c = 0;
+        while (cur) {
+            par = cur;
+            c = str_compare(prefix, s, len, (StrNode*)cur);
+            if (c == 0) return;
+            cur = c < 0 ? cur->left : cur->right;
+        }
+        StrNode *n = new StrNode(s, len);
+        n->parent = par;
+        if (!par) ref_root = n;
+        else if (c < 0) par->left = n;
+        else par->right = n;
+        for (RefNode *p = par; p; p = p->parent) p->size++;
+        rebuild_aux();
+    }
+
+    void remove_key(const char *s, uint32_t len) {
+        StrNode *z = str_search(ref_root, s, len);
+        if (!z) return;
+        // aux nodes reference z; drop them before z is freed
+        free_aux();
+        bst_unlink(ref_root, z);
+        delete z;
+        rebuild_aux();
+    }
+
+    void print_aux_trees() {
+        printf("Aux trees (roots):\n");
+        AuxListNode *cur = aux_list;
+        int idx = 0;
+        while (cur) {
+            printf("Aux %d: ", idx++);
+            print_str_aux_inorder(cur->aroot);
+            printf("\n");
+            cur = cur->next;
+        }
+    }
+
+private:
+    void print_str_aux_inorder(AuxNode *a) {
+        if (!a) return;
+        print_str_aux_inorder(a->left);
+        StrNode *n = (StrNode*)a->ref;
+        printf("%.*s ", (int)n->len, n->data);
+        print_str_aux_inorder(a->right);
+    }
+};
+
+// --- Fixed-capacity Tango for small key sets known at compile time ---
+// Nodes live in inline arrays linked by index (-1 for none), so nothing is
+// heap-allocated. Reference node i holds the i-th smallest key and aux node i
+// stands for reference node i. Unlike the pointer-based forest, each aux tree
+// is kept balanced and ordered by key.
+constexpr int static_tango_depth(int n) {
+    int d = 0;
+    while ((1 << d) - 1 < n) ++d;
+    return d;
+}
+
+template <int N>
+struct StaticTango {
+    static_assert(N > 0, "StaticTango needs at least one key");
+    static constexpr int DEPTH = static_tango_depth(N);
+
+    struct Node { int key, left, right, parent, preferred; };
+    struct Aux { int left, right, parent; };
+
+    std::array<Node, N> ref;
+    std::array<Aux, N> aux;
+    std::array<int, N> aux_roots;
+    int aux_count;
+    int root;
+
+    constexpr StaticTango(): ref{}, aux{}, aux_roots{}, aux_count(0), root(-1) {}
+
+    // 'sorted' must be strictly increasing
+    static constexpr StaticTango from_sorted(const std::array<int, N> &sorted) {
+        StaticTango t;
+        for (int i = 0; i < N; ++i) t.ref[i] = Node{sorted[i], -1, -1, -1, -1};
+        t.root = t.link_ref(0, N - 1, -1);
+        t.rebuild_aux();
+        return t;
+    }
+
+    // Lookup without touching preferred paths; index of the key or -1.
+    // The trip count is fixed at DEPTH so the loop can be fully unrolled.
+    constexpr int find(int key) const {
+        int cur = root;
+        for (int d = 0; d < DEPTH; ++d) {
+            if (cur < 0 || ref[cur].key == key) break;
+            cur = key < ref[cur].key ? ref[cur].left : ref[cur].right;
+        }
+        return cur >= 0 && ref[cur].key == key ? cur : -1;
+    }
+
+    // Access: find the key and make its search path preferred
+    constexpr int access(int key) {
+        int target = find(key);
+        if (target < 0) return -1;
+        for (int i = 0; i < N; ++i) ref[i].preferred = -1;
+        for (int c = target; ref[c].parent >= 0; c = ref[c].parent) {
+            ref[ref[c].parent].preferred = c;
+        }
+        rebuild_aux();
+        return target;
+    }
+
+    constexpr int key_at(int i) const { return ref[i].key; }
+
+    void print_aux_inorder(int a) const {
+        if (a < 0) return;
+        print_aux_inorder(aux[a].left);
+        printf("%d ", ref[a].key);
+        print_aux_inorder(aux[a].right);
+    }
+
+    void print_aux_trees() const {
+        printf("Aux trees (roots):\n");
+        for (int i = 0; i < aux_count; ++i) {
+            printf("Aux %d: ", i);
+            print_aux_inorder(aux_roots[i]);
+            printf("\n");
+        }
+    }
+
+private:
+    constexpr int link_ref(int l, int r, int parent) {
+        if (l > r) return -1;
+        int mid = (l + r) / 2;
+        ref[mid].parent = parent;
+        ref[mid].left = link_ref(l, mid - 1, mid);
+        ref[mid].right = link_ref(mid + 1, r, mid);
+        return mid;
+    }
+
+    // Balanced aux tree over path[l..r] (reference indices in key order)
+    constexpr int link_aux(const std::array<int, N> &path, int l, int r, int parent) {
+        if (l > r) return -1;
+        int mid = (l + r) / 2;
+        int a = path[mid];
+        aux[a].parent = parent;
+        aux[a].left = link_aux(path, l, mid - 1, a);
+        aux[a].right = link_aux(path, mid + 1, r, a);
+        return a;
+    }
+
+    constexpr void rebuild_aux() {
+        aux_count = 0;
+        for (int i = 0; i < N; ++i) {
+            int p = ref[i].parent;
+            if (p >= 0 && ref[p].preferred == i) continue;
+            // i heads a preferred path; collect it and sort by key (= index)
+            std::array<int, N> path{};
+            int len = 0;
+            for (int c = i; c >= 0; c = ref[c].preferred) {
+                int j = len++;
+                while (j > 0 && path[j-1] > c) { path[j] = path[j-1]; --j; }
+                path[j] = c;
+            }
+            aux_roots[aux_count++] = link_aux(path, 0, len - 1, -1);
+        }
+    }
+};
+
+// --- Trace replay (run with: ./tango replay <trace>) ---
+int cmp_int(const void *a, const void *b) {
+    int x = *(const int*)a, y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+// Leading TRACE_LOAD keys, in order; 'first' is the index of the first other event
+int* trace_initial_keys(TraceEvent *ev, long n, int &cnt, long &first) {
+    first = 0;
+    while (first < n && ev[first].op == TRACE_LOAD) first++;
+    cnt = (int)first;
+    int *keys = (int*)malloc(sizeof(int) * (cnt > 0 ? cnt : 1));
+    for (int i = 0; i < cnt; ++i) keys[i] = ev[i].key;
+    return keys;
+}
+
+// Run of the range op at ev[i], sorted with duplicates dropped (malloc'd,
+// 'u' entries). A run cut short by the end of the trace or by another op
+// keeps the keys present; 'i' is left on the last record of the run.
+int* trace_run(TraceEvent *ev, long n, long &i, int &u) {
+    long m = ev[i].key > 0 ? ev[i].key : 0;
+    int *run = (int*)malloc(sizeof(int) * (m > 0 ? m : 1));
+    int cnt = 0;
+    while (cnt < m && i + 1 < n && ev[i+1].op == TRACE_RUN_KEY) run[cnt++] = ev[++i].key;
+    qsort(run, cnt, sizeof(int), cmp_int);
+    u = 0;
+    for (int j = 0; j < cnt; ++j) {
+        if (u == 0 || run[u-1] != run[j]) run[u++] = run[j];
+    }
+    return run;
+}
+
+struct ReplayResult {
+    double ms;
+    double cost;   // Tango: TangoStats::model_cost; static BST: nodes visited
+    ReplayResult(): ms(0), cost(0) {}
+};
+
+ReplayResult replay_tango(TraceEvent *ev, long n, TangoStats &st) {
+    int cnt; long first;
+    int *keys = trace_initial_keys(ev, n, cnt, first);
+    Tango T;
+    T.build_from_sorted_array(keys, cnt);
+    clock_t t0 = clock();
+    for (long i = first; i < n; ++i) {
+        if (ev[i].op == TRACE_ACCESS) T.access(ev[i].key);
+        else if (ev[i].op == TRACE_INSERT) T.insert_key(ev[i].key);
+        else if (ev[i].op == TRACE_REMOVE) T.remove_key(ev[i].key);
+        else if (ev[i].op == TRACE_RANK) T.rank(ev[i].key);
+        else if (ev[i].op == TRACE_SELECT) T.select(ev[i].key);
+        else if (ev[i].op == TRACE_INSERT_RANGE || ev[i].op == TRACE_ERASE_RANGE) {
+            bool ins = ev[i].op == TRACE_INSERT_RANGE;
+            int u;
+            int *run = trace_run(ev, n, i, u);
+            if (ins) T.insert_range(run, u);
+            else T.erase_range(run, u);
+            free(run);
+        }
+    }
+    ReplayResult r;
+    r.ms = 1000.0 * (clock() - t0) / CLOCKS_PER_SEC;
+    r.cost = T.stats.model_cost;
+    st = T.stats;
+    free_aux_list(T.aux_list);
+    free_ref_tree(T.ref_root);
+    free(keys);
+    return r;
+}
+
+// Same trace on the plain (non-adaptive) balanced reference tree
+ReplayResult replay_static_bst(TraceEvent *ev, long n) {
+    int cnt; long first;
+    int *keys = trace_initial_keys(ev, n, cnt, first);
+    RefNode *root = build_ref_from_sorted(keys, 0, cnt-1);
+    ReplayResult r;
+    clock_t t0 = clock();
+    for (long i = first; i < n; ++i) {
+        int key = ev[i].key;
+        if (ev[i].op == TRACE_ACCESS) {
+            long long depth = 0;
+            RefNode *cur = root;
+            while (cur) {
+                ++depth;
+                if (key == cur->key) { r.cost += depth; break; }
+                cur = key < cur->key ? cur->left : cur->right;
+            }
+        } else if (ev[i].op == TRACE_INSERT) {
+            bst_insert(root, key);
+        } else if (ev[i].op == TRACE_REMOVE) {
+            bst_delete(root, bst_search(root, key));
+        } else if (ev[i].op == TRACE_RANK) {
+            // rank walks the search path, hit or miss
+            for (RefNode *cur = root; cur; cur = key < cur->key ? cur->left : cur->right) {
+                r.cost += 1;
+                if (key == cur->key) break;
+            }
+        } else if (ev[i].op == TRACE_SELECT && key >= 0 && key < ref_size(root)) {
+            int k = key;
+            for (RefNode *cur = root; cur; ) {
+                r.cost += 1;
+                int ls = ref_size(cur->left);
+                if (k == ls) break;
+                if (k < ls) {
+                    cur = cur->left;
+                } else {
+                    k -= ls + 1;
+                    cur = cur->right;
+                }
+            }
+        } else if (ev[i].op == TRACE_INSERT_RANGE || ev[i].op == TRACE_ERASE_RANGE) {
+            bool ins = ev[i].op == TRACE_INSERT_RANGE;
+            int u;
+            int *run = trace_run(ev, n, i, u);
+            if (ins) ref_insert_run(root, nullptr, run, 0, u);
+            else ref_erase_run(root, run, 0, u);
+            free(run);
+        }
+    }
+    r.ms = 1000.0 * (clock() - t0) / CLOCKS_PER_SEC;
+    free_ref_tree(root);
+    free(keys);
+    return r;
+}
+
+// Offline reference: the optimal static BST over every key the trace ever
+// holds, weighted by the trace's access counts. Updates are not charged.
+// Above KNUTH_MAX_N keys the tree is Mehlhorn's approximation ('exact' false).
+long long replay_offline_static_cost(TraceEvent *ev, long n, bool &exact) {
+    int *univ = (int*)malloc(sizeof(int) * (n > 0 ? n : 1));
+    int m = 0;
+    uint8_t run_op = 0;   // range op that the current TRACE_RUN_KEY records belong to
+    for (long i = 0; i < n; ++i) {
+        uint8_t op = ev[i].op;
+        if (op != TRACE_RUN_KEY) run_op = op;
+        if (op == TRACE_LOAD || op == TRACE_INSERT || (op == TRACE_RUN_KEY && run_op == TRACE_INSERT_RANGE))
+            univ[m++] = ev[i].key;
+    }
+    qsort(univ, m, sizeof(int), cmp_int);
+    int u = 0;
+    for (int i = 0; i < m; ++i) {
+        if (u == 0 || univ[u-1] != univ[i]) univ[u++] = univ[i];
+    }
+    double *w = (double*)calloc(u > 0 ? u : 1, sizeof(double));
+    for (long i = 0; i < n; ++i) {
+        if (ev[i].op != TRACE_ACCESS) continue;
+        int *hit = (int*)bsearch(&ev[i].key, univ, u, sizeof(int), cmp_int);
+        if (hit) w[hit - univ] += 1;
+    }
+    exact = u <= KNUTH_MAX_N;
+    RefNode *opt = build_ref_from_weights(univ, w, u);
+    long long cost = (long long)ref_weighted_cost(opt, univ, w, u);
+    free_ref_tree(opt);
+    free(w);
+    free(univ);
+    return cost;
+}
+
+int run_replay(const char *path) {
+    long n;
+    TraceEvent *ev = trace_load(path, n);
+    if (!ev) {
+        fprintf(stderr, "cannot read trace '%s'\n", path);
+        return 1;
+    }
+    long counts[TRACE_OPS] = {0};
+    for (long i = 0; i < n; ++i) {
+        if (ev[i].op < TRACE_OPS) counts[ev[i].op]++;
+    }
+    printf("replay %s: %ld initial keys, %ld accesses, %ld inserts, %ld removes, "
+           "%ld range inserts, %ld range erases, %ld rank/select\n",
+           path, counts[TRACE_LOAD], counts[TRACE_ACCESS], counts[TRACE_INSERT], counts[TRACE_REMOVE],
+           counts[TRACE_INSERT_RANGE], counts[TRACE_ERASE_RANGE], counts[TRACE_RANK] + counts[TRACE_SELECT]);
+    TangoStats st;
+    ReplayResult t = replay_tango(ev, n, st);
+    ReplayResult s = replay_static_bst(ev, n);
+    bool exact;
+    long long opt = replay_offline_static_cost(ev, n, exact);
+    printf("  tango:       %10.1f ms  cost %.0f ((switches+1)(1+lg lg n)); %lld switches, %lld path nodes\n",
+           t.ms, t.cost, st.pref_switches, st.ref_nodes);
+    printf("  static BST:  %10.1f ms  cost %.0f nodes\n", s.ms, s.cost);
+    printf("  offline opt:                cost %lld nodes (%s)\n", opt,
+           exact ? "optimal static BST" : "Mehlhorn approximation of the optimal static BST");
+    free(ev);
+    return 0;
+}
+
+// --- Benchmarks (run with: ./tango bench) ---
+uint64_t bench_rand(uint64_t &s) {
+    s ^= s << 13;
+    s ^= s >> 7;
+    s ^= s << 17;
+    return s;
+}
+
+// Zipf(1.1) weights assigned to a random permutation of the keys, so hot
+// keys are scattered over the key space rather than clustered.
+void bench_zipf_weights(double *w, int n, uint64_t &seed) {
+    int *perm = (int*)malloc(sizeof(int) * n);
+    for (int i = 0; i < n; ++i) perm[i] = i;
+    for (int i = n - 1; i > 0; --i) {
+        int j = (int)(bench_rand(seed) % (uint64_t)(i + 1));
+        int t = perm[i]; perm[i] = perm[j]; perm[j] = t;
+    }
+    for (int i = 0; i < n; ++i) w[perm[i]] = 1.0 / pow((double)(i + 1), 1.1);
+    free(perm);
+}
+
+// Draw 'q' keys according to weights 'w' (inverse CDF)
+int* bench_sample_keys(int *keys, double *w, int n, int q, uint64_t &seed) {
+    double *cdf = (double*)malloc(sizeof(double) * n);
+    double acc = 0;
+    for (int i = 0; i < n; ++i) { acc += w[i]; cdf[i] = acc; }
+    int *out = (int*)malloc(sizeof(int) * q);
+    for (int i = 0; i < q; ++i) {
+        double u = (double)(bench_rand(seed) >> 11) / 9007199254740992.0 * acc;
+        int lo = 0, hi = n - 1;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (cdf[mid] >= u) hi = mid;
+            else lo = mid + 1;
+        }
+        out[i] = keys[lo];
+    }
+    free(cdf);
+    return out;
+}
+
+// 'q' keys drawn uniformly from keys[0, n)
+int* bench_uniform_keys(int *keys, int n, int q, uint64_t &seed) {
+    int *out = (int*)malloc(sizeof(int) * q);
+    for (int i = 0; i < q; ++i) out[i] = keys[bench_rand(seed) % (uint64_t)n];
+    return out;
+}
+
+double bench_time_lookups(RefNode *root, int *queries, int q) {
+    clock_t t0 = clock();
+    long found = 0;
+    for (int i = 0; i < q; ++i) found += bst_search(root, queries[i]) != nullptr;
+    double ms = 1000.0 * (clock() - t0) / CLOCKS_PER_SEC;
+    if (found != q) printf("  (warning: %ld of %d lookups missed)\n", q - found, q);
+    return ms;
+}
+
+void bench_weighted_shape(int n, int q) {
+    uint64_t seed = 0x9E3779B97F4A7C15ull ^ (uint64_t)n;
+    int *keys = (int*)malloc(sizeof(int) * n);
+    double *w = (double*)malloc(sizeof(double) * n);
+    for (int i = 0; i < n; ++i) keys[i] = 2 * i;
+    bench_zipf_weights(w, n, seed);
+    double total = 0;
+    for (int i = 0; i < n; ++i) total += w[i];
+    int *queries = bench_sample_keys(keys, w, n, q, seed);
+
+    RefNode *balanced = build_ref_from_sorted(keys, 0, n-1);
+    RefNode *weighted = build_ref_from_weights(keys, w, n);
+    printf("n=%d (%s), %d zipf lookups\n", n, n <= KNUTH_MAX_N ? "Knuth DP" : "Mehlhorn", q);
+    printf("  balanced: expected depth %.3f, %.1f ms\n",
+           ref_weighted_cost(balanced, keys, w, n) / total, bench_time_lookups(balanced, queries, q));
+    printf("  weighted: expected depth %.3f, %.1f ms\n",
+           ref_weighted_cost(weighted, keys, w, n) / total, bench_time_lookups(weighted, queries, q));
+
+    free_ref_tree(balanced);
+    free_ref_tree(weighted);
+    free(queries);
+    free(w);
+    free(keys);
+}
+
+// Uniform random lookups on a tree larger than cache
+void bench_prefetch(int n, int q) {
+    uint64_t seed = 0xD1B54A32D192ED03ull;
+    int *keys = (int*)malloc(sizeof(int) * n);
+    for (int i = 0; i < n; ++i) keys[i] = 2 * i;
+    RefNode *root = build_ref_from_sorted(keys, 0, n-1);
+    int *queries = bench_uniform_keys(keys, n, q, seed);
+    RefNode **out = (RefNode**)malloc(sizeof(RefNode*) * q);
+
+    printf("n=%d, %d uniform lookups\n", n, q);
+    printf("  bst_search:          %.1f ms\n", bench_time_lookups(root, queries, q));
+    clock_t t0 = clock();
+    bst_search_batch(root, queries, q, out);
+    long found = 0;
+    for (int i = 0; i < q; ++i) found += out[i] != nullptr;
+    printf("  bst_search_batch:    %.1f ms (%ld found)\n", 1000.0 * (clock() - t0) / CLOCKS_PER_SEC, found);
+
+    free(out);
+    free(queries);
+    free_ref_tree(root);
+    free(keys);
+}
+
+// Zipf accesses through Tango::access with and without the front cache
+void bench_hot_cache(int n, int q, int sample_every) {
+    uint64_t seed = 0xA0761D6478BD642Full;
+    int *keys = (int*)malloc(sizeof(int) * n);
+    double *w = (double*)malloc(sizeof(double) * n);
+    for (int i = 0; i < n; ++i) keys[i] = 2 * i;
+    bench_zipf_weights(w, n, seed);
+    int *queries = bench_sample_keys(keys, w, n, q, seed);
+
+    printf("n=%d, %d zipf Tango::access calls\n", n, q);
+    for (int pass = 0; pass < 2; ++pass) {
+        Tango T;
+        T.build_from_sorted_array(keys, n);
+        if (pass == 1) T.enable_hot_cache(256, sample_every);
+        clock_t t0 = clock();
+        for (int i = 0; i < q; ++i) T.access(queries[i]);
+        double ms = 1000.0 * (clock() - t0) / CLOCKS_PER_SEC;
+        if (pass == 0) {
+            printf("  no cache:          %.1f ms\n", ms);
+        } else {
+            printf("  hot cache (1/%d):  %.1f ms, %lld hits, %lld misses\n",
+                   sample_every, ms, T.hot->hits, T.hot->misses);
+        }
+        T.disable_hot_cache();
+        free_aux_list(T.aux_list);
+        free_ref_tree(T.ref_root);
+    }
+    free(queries);
+    free(w);
+    free(keys);
+}
+
+// Worst single-operation latency with eager vs budgeted aux rebuilds
+void bench_rebuild_budget(int n, int q, int budget) {
+    uint64_t seed = 0xE7037ED1A0B428DBull;
+    int *keys = (int*)malloc(sizeof(int) * n);
+    for (int i = 0; i < n; ++i) keys[i] = 2 * i;
+    printf("n=%d, %d access/insert_key calls\n", n, q);
+    for (int pass = 0; pass < 2; ++pass) {
+        Tango T;
+        T.build_from_sorted_array(keys, n);
+        if (pass == 1) T.set_rebuild_budget(budget);
+        double worst = 0;
+        clock_t t0 = clock();
+        for (int i = 0; i < q; ++i) {
+            int key = 2 * (int)(bench_rand(seed) % (uint64_t)(2 * n));
+            clock_t s = clock();
+            if (i % 8 == 0) T.insert_key(key + 1);
+            else T.access(key);
+            double us = 1e6 * (clock() - s) / CLOCKS_PER_SEC;
+            if (us > worst) worst = us;
+        }
+        double ms = 1000.0 * (clock() - t0) / CLOCKS_PER_SEC;
+        if (pass == 0) printf("  eager:        %.1f ms total, worst op %.0f us\n", ms, worst);
+        else printf("  budget %4d:  %.1f ms total, worst op %.0f us\n", budget, ms, worst);
+        T.set_rebuild_budget(0);
+        T.clear();
+    }
+    free(keys);
+}
+
+// Uniform random lookups with and without packed leaf blocks
+void bench_leaf_blocks(int n, int q) {
+    uint64_t seed = 0x8BB84B93962EACC9ull;
+    int *keys = (int*)malloc(sizeof(int) * n);
+    for (int i = 0; i < n; ++i) keys[i] = 2 * i;
+    int *queries = bench_uniform_keys(keys, n, q, seed);
+    RefNode *root = build_ref_from_sorted(keys, 0, n-1);
+    LeafBlock *blocks = nullptr;
+    leaf_blocks_build(root, blocks);
+
+    printf("n=%d, %d uniform lookups, %d-key leaf blocks\n", n, q, LEAF_BLOCK_KEYS);
+    printf("  bst_search:          %.1f ms\n", bench_time_lookups(root, queries, q));
+    clock_t t0 = clock();
+    long found = 0;
+    for (int i = 0; i < q; ++i) found += bst_search_blocked(root, queries[i]) != nullptr;
+    printf("  bst_search_blocked:  %.1f ms (%ld found)\n", 1000.0 * (clock() - t0) / CLOCKS_PER_SEC, found);
+
+    leaf_blocks_free(blocks);
+    free_ref_tree(root);
+    free(queries);
+    free(keys);
+}
+
+// Baseline for bench_str_keys: generic comparator that always reads the heap key
+StrNode* bench_str_search_full(RefNode *root, const char *s, uint32_t len) {
+    RefNode *cur = root;
+    while (cur) {
+        StrNode *n = (StrNode*)cur;
+        uint32_t m = len < n->len ? len : n->len;
+        int c = memcmp(s, n->data, m);
+        if (c == 0) c = (len > n->len) - (len < n->len);
+        if (c == 0) return n;
+        cur = c < 0 ? cur->left : cur->right;
+    }
+    return nullptr;
+}
+
+int cmp_str(const void *a, const void *b) {
+    return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+// Random 16-byte hex string keys: inline-prefix compare vs full compare
+void bench_str_keys(int n, int q) {
+    uint64_t seed = 0x589965CC75374CC3ull;
+    const int L = 16;
+    char *pool = (char*)malloc((size_t)n * (L + 1));
+    const char **keys = (const char**)malloc(sizeof(char*) * n);
+    uint32_t *lens = (uint32_t*)malloc(sizeof(uint32_t) * n);
+    for (int i = 0; i < n; ++i) {
+        char *k = pool + (size_t)i * (L + 1);
+        snprintf(k, L + 1, "%016llx", (unsigned long long)bench_rand(seed));
+        keys[i] = k;
+        lens[i] = L;
+    }
+    qsort(keys, n, sizeof(char*), cmp_str);
+    const char **queries = (const char**)malloc(sizeof(char*) * q);
+    for (int i = 0; i < q; ++i) queries[i] = keys[bench_rand(seed) % (uint64_t)n];
+    StrTango T;
+    T.build_from_sorted_array(keys, lens, n);
+
+    printf("n=%d, %d uniform lookups, %d-byte string keys\n", n, q, L);
+    clock_t t0 = clock();
+    long found = 0;
+    for (int i = 0; i < q; ++i) found += bench_str_search_full(T.ref_root, queries[i], L) != nullptr;
+    printf("  full compare:    %.1f ms (%ld found)\n", 1000.0 * (clock() - t0) / CLOCKS_PER_SEC, found);
+    t0 = clock();
+    found = 0;
+    for (int i = 0; i < q; ++i) found += T.find(queries[i], L) != nullptr;
+    printf("  inline prefix:   %.1f ms (%ld found)\n", 1000.0 * (clock() - t0) / CLOCKS_PER_SEC, found);
+
+    T.clear();
+    free(queries);
+    free(lens);
+    free(keys);
+    free(pool);
+}
+
+// Sorted-run ingest: per-key insert_key/remove_key vs insert_range/erase_range
+void bench_ranges(int n, int m) {
+    int *keys = (int*)malloc(sizeof(int) * n);
+    int *run = (int*)malloc(sizeof(int) * m);
+    for (int i = 0; i < n; ++i) keys[i] = 4 * i;
+    for (int i = 0; i < m; ++i) run[i] = 4 * (n / 4) + 2 * i + 1;   // interleaves the upper keys
+    printf("n=%d, sorted run of %d keys\n", n, m);
+    for (int pass = 0; pass < 2; ++pass) {
+        Tango T;
+        T.build_from_sorted_array(keys, n);
+        clock_t t0 = clock();
+        if (pass == 0) {
+            for (int i = 0; i < m; ++i) T.insert_key(run[i]);
+        } else {
+            T.insert_range(run, m);
+        }
+        double ins = 1000.0 * (clock() - t0) / CLOCKS_PER_SEC;
+        t0 = clock();
+        if (pass == 0) {
+            for (int i = 0; i < m; ++i) T.remove_key(run[i]);
+        } else {
+            T.erase_range(run, m);
+        }
+        double del = 1000.0 * (clock() - t0) / CLOCKS_PER_SEC;
+        printf("  %s insert %.1f ms, erase %.1f ms\n", pass == 0 ? "per key:" : "range:  ", ins, del);
+        T.clear();
+    }
+    free(run);
+    free(keys);
+}
+
+int run_bench() {
+    bench_weighted_shape(500, 2000000);
+    bench_weighted_shape(1 << 20, 2000000);
+    bench_prefetch(1 << 21, 2000000);
+    bench_leaf_blocks(1 << 21, 2000000);
+    bench_str_keys(1 << 20, 2000000);
+    bench_hot_cache(4096, 5000, 64);
+    bench_rebuild_budget(20000, 2000, 256);
+    bench_ranges(20000, 2000);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) return run_bench();
+    if (argc > 2 && strcmp(argv[1], "replay") == 0) return run_replay(argv[2]);
+
+    // Build Tango from sorted keys
+    int keys[] = {10, 20, 30, 40, 50, 60, 70};
+    int n = sizeof(keys)/sizeof(keys[0]);
+
+    Tango T;
+    T.build_from_sorted_array(keys, n);
+
+    // Record the demo so it can be replayed below
+    const char *trace_path = "tango_trace.bin";
+    TraceWriter tw;
+    if (trace_open(tw, trace_path)) T.set_trace(&tw);
+
+    printf("Initial reference tree inorder: ");
+    T.print_ref_tree();
+    T.print_aux_trees();
+
+    printf("\nAccess 50\n");
+    T.access(50);
+    T.print_aux_trees();
+
+    printf("\nAccess 20\n");
+    T.access(20);
+    T.print_aux_trees();
+
+    printf("\nInsert 25\n");
     T.insert_key(25);
     T.print_ref_tree();
     T.print_aux_trees();
@@ -512,6 +2827,97 @@ int main() {
     T.print_ref_tree();
     T.print_aux_trees();
 
+    printf("\nRank 50: %d\n", T.rank(50));
+    RefNode *kth = T.select(2);
+    printf("Select 2: %d\n", kth ? kth->key : -1);
+    T.print_aux_trees();
+
+    printf("\nSplit at 30, join back\n");
+    Tango lo, hi;
+    T.split(30, lo, hi);
+    lo.print_ref_tree();
+    hi.print_ref_tree();
+    T = Tango::join(lo, hi);
+    T.print_ref_tree();
+    T.print_aux_trees();
+
+    printf("\nInsert run 33 35 37, erase run 10 35 60\n");
+    int ins_run[] = {33, 35, 37};
+    int del_run[] = {10, 35, 60};
+    T.insert_range(ins_run, 3);
+    T.erase_range(del_run, 3);
+    T.print_ref_tree();
+    T.print_aux_trees();
+
+    printf("\nBudgeted aux rebuild (4 units per operation)\n");
+    int bkeys[200];
+    for (int i = 0; i < 200; ++i) bkeys[i] = 2 * i;
+    Tango B;
+    B.build_from_sorted_array(bkeys, 200);
+    B.set_rebuild_budget(4);
+    uint64_t bseed = 0x5DEECE66Dull;
+    int checks = 0, bad = 0;
+    for (int i = 0; i < 600; ++i) {
+        int key = (int)(bench_rand(bseed) % 420);
+        if (i % 6 == 0) B.insert_key(key);
+        else if (i % 6 == 1) B.remove_key(key);
+        else B.access(key);
+        // once the pending builds are done the forest must match the preferred paths
+        if (i % 100 == 99) {
+            B.rebuild_finish();
+            checks++;
+            if (!aux_forest_check(B.ref_root, B.aux_list)) bad++;
+        }
+    }
+    printf("%d keys after 600 operations; aux forest checked %d times, %d mismatches\n",
+           ref_size(B.ref_root), checks, bad);
+    B.set_rebuild_budget(0);
+    B.clear();
+
+    printf("\nStatic Tango (built at compile time)\n");
+    static constexpr std::array<int, 7> static_keys = {10, 20, 30, 40, 50, 60, 70};
+    static constexpr StaticTango<7> static_tree = StaticTango<7>::from_sorted(static_keys);
+    static_assert(static_tree.find(40) >= 0 && static_tree.find(45) < 0, "compile-time lookup");
+    StaticTango<7> S = static_tree;
+    S.access(50);
+    S.print_aux_trees();
+
+    printf("\nString keys\n");
+    const char *words[] = {"apple", "apricot", "banana", "blueberry", "cherry"};
+    uint32_t word_lens[5];
+    for (int i = 0; i < 5; ++i) word_lens[i] = (uint32_t)strlen(words[i]);
+    StrTango W;
+    W.build_from_sorted_array(words, word_lens, 5);
+    W.insert_key("blackberry", 10);
+    W.access("apricot", 7);
+    W.remove_key("cherry", 6);
+    W.print_aux_trees();
+    W.clear();
+
+    printf("\nSnapshot save/load\n");
+    const char *snap_path = "tango_snapshot.bin";
+    if (T.save_snapshot(snap_path)) {
+        Tango R;
+        if (R.load_snapshot(snap_path)) {
+            // served from the mapping; print_ref_tree then materializes the tree
+            printf("Mapped contains 50: %s\n", R.contains(50) ? "yes" : "no");
+            R.print_ref_tree();
+            R.print_aux_trees();
+        }
+        unlink(snap_path);
+    }
+
+    T.set_trace(nullptr);
+    if (tw.f) {
+        if (trace_close(tw)) {
+            printf("\n");
+            run_replay(trace_path);
+        } else {
+            fprintf(stderr, "trace '%s' incomplete: write failed after %ld records\n", trace_path, tw.count);
+        }
+        unlink(trace_path);
+    }
+
     return 0;
 }
 